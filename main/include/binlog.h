@@ -0,0 +1,100 @@
+#pragma once
+
+#include "common.h"
+#include "binlog_ids.h"
+#include "config.h"
+
+// Compact binary logging into an RTC memory ring buffer.
+//
+// Each record is a header word (level, tag ID, format ID, argument count), a
+// timestamp word (boot sequence + milliseconds since boot) and up to
+// BINLOG_MAX_ARGS 32-bit arguments. Format strings never leave the source
+// tree: the buffer is decoded off-device by tools/binlog_decode.py. The ring
+// survives deep sleep and resets other than power-on, so records from several
+// wake cycles (including one that crashed) accumulate until they are flushed
+// to UART in diagnostic mode or uploaded over MQTT on request.
+
+#define BINLOG_LEVEL_NONE  0
+#define BINLOG_LEVEL_ERROR 1
+#define BINLOG_LEVEL_WARN  2
+#define BINLOG_LEVEL_INFO  3
+#define BINLOG_LEVEL_DEBUG 4
+
+// Records above this level are compiled out (arguments are still type-checked)
+#ifndef BINLOG_LEVEL
+    #if DEBUG_LOGS
+        #define BINLOG_LEVEL BINLOG_LEVEL_DEBUG
+    #else
+        #define BINLOG_LEVEL BINLOG_LEVEL_INFO
+    #endif
+#endif
+
+// Ring buffer size in 32-bit words (kept in RTC memory)
+#ifndef BINLOG_BUFFER_WORDS
+    #define BINLOG_BUFFER_WORDS 256
+#endif
+
+// MQTT topics for on-demand upload. Publish a retained non-empty message
+// (e.g. "1") to the request topic; the device uploads its buffer to the log
+// topic (retained) on its next publishing wake, and clears the request and
+// the buffer once the upload is acknowledged.
+#ifndef MQTT_TOPIC_LOG
+    #define MQTT_TOPIC_LOG "home/mousetrap/" TRAP_ID "/log"
+#endif
+#ifndef MQTT_TOPIC_LOG_REQUEST
+    #define MQTT_TOPIC_LOG_REQUEST "home/mousetrap/" TRAP_ID "/log/request"
+#endif
+
+#define BINLOG_MAX_ARGS 6
+#define BINLOG_MAGIC 0x31474C42  // "BLG1"
+
+// Count variadic arguments (0..6)
+#define BINLOG_NARGS(...) BINLOG_NARGS_(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define BINLOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, n, ...) n
+
+#define BINLOG_WRITE(level, tag, fmt, ...) \
+    binlog_write(level, BINLOG_TAG_##tag, BINLOG_FMT_##fmt, BINLOG_NARGS(__VA_ARGS__), ##__VA_ARGS__)
+
+#if BINLOG_LEVEL >= BINLOG_LEVEL_ERROR
+    #define BINLOG_E(tag, fmt, ...) BINLOG_WRITE(BINLOG_LEVEL_ERROR, tag, fmt, ##__VA_ARGS__)
+#else
+    #define BINLOG_E(tag, fmt, ...) do { if (0) BINLOG_WRITE(BINLOG_LEVEL_ERROR, tag, fmt, ##__VA_ARGS__); } while (0)
+#endif
+#if BINLOG_LEVEL >= BINLOG_LEVEL_WARN
+    #define BINLOG_W(tag, fmt, ...) BINLOG_WRITE(BINLOG_LEVEL_WARN, tag, fmt, ##__VA_ARGS__)
+#else
+    #define BINLOG_W(tag, fmt, ...) do { if (0) BINLOG_WRITE(BINLOG_LEVEL_WARN, tag, fmt, ##__VA_ARGS__); } while (0)
+#endif
+#if BINLOG_LEVEL >= BINLOG_LEVEL_INFO
+    #define BINLOG_I(tag, fmt, ...) BINLOG_WRITE(BINLOG_LEVEL_INFO, tag, fmt, ##__VA_ARGS__)
+#else
+    #define BINLOG_I(tag, fmt, ...) do { if (0) BINLOG_WRITE(BINLOG_LEVEL_INFO, tag, fmt, ##__VA_ARGS__); } while (0)
+#endif
+#if BINLOG_LEVEL >= BINLOG_LEVEL_DEBUG
+    #define BINLOG_D(tag, fmt, ...) BINLOG_WRITE(BINLOG_LEVEL_DEBUG, tag, fmt, ##__VA_ARGS__)
+#else
+    #define BINLOG_D(tag, fmt, ...) do { if (0) BINLOG_WRITE(BINLOG_LEVEL_DEBUG, tag, fmt, ##__VA_ARGS__); } while (0)
+#endif
+
+// Start a new boot sequence; call first thing in app_main
+void binlog_init(void);
+
+// Append a record (use the BINLOG_x macros rather than calling this directly)
+void binlog_write(int level, int tag, int fmt, int nargs, ...);
+
+// Copy the buffer (oldest record first) into out as an upload blob.
+// Returns the number of bytes written, or 0 if out is too small.
+size_t binlog_snapshot(uint8_t *out, size_t out_len);
+
+// Size of the blob binlog_snapshot would currently produce
+size_t binlog_snapshot_size(void);
+
+// Discard all buffered records
+void binlog_clear(void);
+
+// Dump the buffer to the console as hex lines and clear it (diagnostic mode)
+void binlog_flush_uart(void);
+
+// Upload the buffer if request, the retained payload of the log request
+// topic (NULL if none), asks for it (MQTT must be connected)
+void binlog_handle_upload_request(const char *request);
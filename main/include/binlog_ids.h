@@ -0,0 +1,124 @@
+#pragma once
+
+// Tag and format tables for the binary log.
+// Records only carry the numeric IDs; tools/binlog_decode.py parses this file
+// to turn them back into text. IDs are assigned by position, so only ever
+// append new entries to the end of a table - never reorder or remove them,
+// otherwise logs captured from older firmware will decode incorrectly.
+
+#define BINLOG_TAGS(X) \
+    X(MAIN,   "main") \
+    X(SENSOR, "sensor_manager") \
+    X(WIFI,   "wifi_manager") \
+    X(MQTT,   "mqtt_manager") \
+    X(DIAG,   "diagnostic") \
+    X(BINLOG, "binlog") \
+    X(SUPERVISOR, "cycle_supervisor") \
+    X(TELEMETRY, "telemetry") \
+    X(TLS,    "mqtt_tls") \
+    X(OTA,    "ota_manager") \
+    X(CONFIG, "device_config") \
+    X(POWER,  "power_governor")
+
+#define BINLOG_FORMATS(X) \
+    X(BOOT,                "Boot %d: reset reason %d, wake cause %d, wake circuit %d") \
+    X(STATES_CURRENT,      "Current states - trap triggered: %d, battery low: %d") \
+    X(STATES_PREVIOUS,     "Previous states - trap triggered: %d, battery low: %d") \
+    X(HEARTBEAT_FORCED,    "Timer wakeup with wake circuit - forcing heartbeat") \
+    X(CYCLES,              "Cycles since last publish: %d/%d") \
+    X(PUBLISH_TRAP,        "Publishing trap state (triggered: %d)") \
+    X(PUBLISH_TRAP_OK,     "Successfully published trap state") \
+    X(PUBLISH_BATTERY,     "Publishing battery state (low: %d)") \
+    X(PUBLISH_BATTERY_OK,  "Successfully published battery state") \
+    X(PUBLISH_FAILED,      "Failed to connect - will retry on next state change") \
+    X(PUBLISH_SKIPPED,     "No state changes detected, skipping publish") \
+    X(WAKE_GPIO,           "Wakeup from GPIO %d") \
+    X(WAKE_CIRCUIT,        "Wakeup triggered by wake circuit - trap state will be published") \
+    X(WAKE_PIN_LEVEL,      "Wake pin level: %d, woken by wake circuit: %d") \
+    X(SENSOR1_OVERRIDE,    "Setting sensor1 max_value to %d") \
+    X(SLEEP_WAKE_PIN,      "Current wake pin level before sleep: %d") \
+    X(SLEEP_HOURS,         "Going to sleep for %d hours (or until wake pin triggers)") \
+    X(SLEEP_SECONDS,       "Going to sleep for %d seconds") \
+    X(ADC_INIT,            "ADC initialized successfully") \
+    X(BURST_DONE,          "Burst sampling completed - LDR1 min %d max %d, LDR2 min %d max %d") \
+    X(BATTERY_DONE,        "Battery sampling completed - min %d max %d") \
+    X(WIFI_STA_START,      "WiFi station started, attempting to connect...") \
+    X(WIFI_STA_CONNECTED,  "WiFi station connected to AP") \
+    X(WIFI_DISCONNECTED,   "WiFi disconnected, reason: %d") \
+    X(WIFI_AUTHMODE,       "WiFi authentication mode changed") \
+    X(WIFI_GOT_IP,         "Got IP address: %d.%d.%d.%d") \
+    X(WIFI_MAC,            "Device MAC: %02x:%02x:%02x:%02x:%02x:%02x") \
+    X(WIFI_STARTED,        "WiFi started, waiting for connection...") \
+    X(WIFI_RSSI,           "Connected to AP, RSSI: %d") \
+    X(WIFI_TIMEOUT,        "Failed to get IP address within timeout period") \
+    X(MQTT_CONNECTED,      "MQTT Connected") \
+    X(MQTT_DISCONNECTED,   "MQTT Disconnected") \
+    X(MQTT_ERROR,          "MQTT Error occurred") \
+    X(MQTT_PUBLISHED,      "MQTT Message %d published successfully") \
+    X(MQTT_INIT_FAILED,    "Failed to initialize MQTT client") \
+    X(MQTT_START_FAILED,   "Failed to start MQTT client") \
+    X(MQTT_WAITING,        "Waiting for MQTT connection... (%d/%d)") \
+    X(MQTT_CONNECT_OK,     "MQTT connected successfully") \
+    X(MQTT_TIMEOUT,        "MQTT connection timeout after %d seconds") \
+    X(MQTT_RETAINED,       "Received %d byte retained message for pending request") \
+    X(LOG_UPLOAD,          "Uploading log buffer on request (%d words, %d records dropped)") \
+    X(LOG_UPLOAD_FAILED,   "Failed to upload log buffer") \
+    X(TRACE_UPLOAD,        "Uploading burst traces (%d bytes)") \
+    X(CYCLE_OVERRUN,       "Awake budget of %d ms exceeded in phase %d - winding down") \
+    X(CYCLE_FORCED_SLEEP,  "Wind-down did not finish (phase %d) - forcing deep sleep") \
+    X(CYCLE_RESET,         "Previous cycle ended in reset reason %d during phase %d") \
+    X(CYCLE_ABORT,         "Cycle aborted (reason %d, detail 0x%x) in phase %d") \
+    X(TELEMETRY_FAILED,    "Failed to publish telemetry") \
+    X(TLS_CONNECT_FAILED,  "TLS: TCP connection to port %d failed") \
+    X(TLS_SETUP_FAILED,    "TLS setup failed: -0x%04x") \
+    X(TLS_HANDSHAKE,       "TLS handshake took %d ms (resumed %d)") \
+    X(TLS_HANDSHAKE_FAILED, "TLS handshake failed: -0x%04x (session offered %d)") \
+    X(TLS_SESSION_NOT_SAVED, "TLS session not cached (%d of %d bytes)") \
+    X(MQTT_TRANSPORT_FAILED, "Failed to create TLS transport") \
+    X(SENSOR_BURST_DONE,   "Burst sampling completed - sensor %d min %d max %d") \
+    X(SENSOR_STATE,        "Sensor %d state %d (previous %d)") \
+    X(PUBLISH_SENSOR,      "Publishing sensor %d state: %d") \
+    X(PUBLISH_SENSOR_OK,   "Sensor %d state published successfully") \
+    X(WAKE_SENSORS,        "Wake circuit triggered sensors (mask 0x%x)") \
+    X(SLEEP_WAKE_PINS,     "Wake pins 0x%x before sleep, levels 0x%x") \
+    X(OTA_BAD_REQUEST,     "Malformed OTA request (expected '<version> <url or mqtt>')") \
+    X(OTA_REQUEST,         "OTA update requested (delta over MQTT %d)") \
+    X(OTA_ROLLED_BACK,     "Requested OTA version was rolled back before - not retrying") \
+    X(OTA_SOURCE_MISMATCH, "OTA delta was made against a different image") \
+    X(OTA_DELTA,           "OTA delta: %d byte image from %d byte source, flags 0x%x") \
+    X(OTA_FLASH_FAILED,    "OTA partition operation failed: 0x%x") \
+    X(OTA_HTTP_FAILED,     "OTA HTTP download failed: err 0x%x, status %d") \
+    X(OTA_PATCH_FAILED,    "OTA patch failed: result %d after %d bytes") \
+    X(OTA_RESULT,          "OTA finished with error %d: %d bytes received in %d ms") \
+    X(OTA_CONFIRMED,       "Updated firmware published on first boot - rollback cancelled") \
+    X(OTA_ROLLBACK,        "Updated firmware failed to publish on first boot - rolling back") \
+    X(OTA_RESTART,         "Restarting into updated firmware") \
+    X(BOOT_TIME,           "Reset to app_main took %d us (deep sleep wake %d)") \
+    X(CONFIG_LOADED,       "Provisioned device config loaded (%d settings)") \
+    X(CONFIG_LOAD_FAILED,  "Reading the provisioned device config failed: %d") \
+    X(CONFIG_COMMITTED,    "Device provisioned (%d settings written)") \
+    X(SUPPLY_READING,      "Supply %d mV, filtered %d mV, power stage %d") \
+    X(SUPPLY_READ_FAILED,  "Supply voltage read failed: %d") \
+    X(POWER_STAGE,         "Power stage %d -> %d at %d mV") \
+    X(OPTIONAL_SKIPPED,    "Uploads and OTA check skipped in power stage %d") \
+    X(TRIGGER_LATENCY,     "Trigger to PUBACK %d ms (boot %d ms)") \
+    X(TRIGGER_NO_PUBACK,   "No PUBACK for the trigger publish within %d ms") \
+    X(LINK_LEVEL,          "Link level %d -> %d (TX %d dBm, average RSSI %d)") \
+    X(LINK_APPLY_FAILED,   "Applying link level %d failed: 0x%x") \
+    X(OTA_REARMED,         "Rolled back OTA version requested again - retrying") \
+    X(OTA_CONFIRM_RETRY,   "Updated firmware could not connect - retry %d, %d ms of budget left") \
+    X(SUPPLY_UNCALIBRATED, "Supply %d mV read without ADC calibration - power stage unchanged") \
+    X(UPLOAD_NO_PUBACK,    "Upload not acknowledged within %d ms - buffer kept for the next attempt")
+
+#define BINLOG_TAG_ENUM(name, str) BINLOG_TAG_##name,
+#define BINLOG_FMT_ENUM(name, str) BINLOG_FMT_##name,
+
+typedef enum {
+    BINLOG_TAGS(BINLOG_TAG_ENUM)
+    BINLOG_TAG_COUNT
+} binlog_tag_t;
+
+typedef enum {
+    BINLOG_FORMATS(BINLOG_FMT_ENUM)
+    BINLOG_FMT_COUNT
+} binlog_fmt_t;
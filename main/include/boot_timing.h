@@ -0,0 +1,31 @@
+#pragma once
+
+#include "common.h"
+#include "config.h"
+
+// Reset-to-app_main latency, measured on the RTC slow timer (which keeps
+// running through deep sleep and resets only at power-on).
+//
+// On a deep sleep wake, a wake stub timestamps the first instruction after
+// the ROM, so the measurement covers the bootloader, image load and IDF
+// startup. After a power-on reset the RTC timer starts at zero, so its value
+// at app_main is the whole cold start. Kept in RTC memory and reported with
+// telemetry.
+
+typedef struct {
+    uint32_t last_us;           // Wake stub to app_main, this wake (0 on other boots)
+    uint32_t wake_avg_us;       // Average over deep sleep wakes since power-up
+    uint32_t wake_max_us;       // Slowest deep sleep wake since power-up
+    uint32_t cold_us;           // Power-on reset to app_main at the last power-up
+    uint32_t wakes;             // Deep sleep wakes measured
+} boot_timing_t;
+
+// Take the app_main timestamp; call at the start of app_main
+void boot_timing_record(void);
+
+// Measurements for telemetry
+const boot_timing_t *boot_timing_get(void);
+
+// RTC time of this wake's wake stub in microseconds since power-on, i.e. the
+// moment the wake source fired (0 if this was not a measured deep sleep wake)
+uint64_t boot_timing_wake_us(void);
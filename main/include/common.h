@@ -14,4 +14,18 @@
 #endif
 
 // Common error checking macro
-#define ESP_RETURN_ON_ERROR(x, tag, msg) do { esp_err_t __err_rc = (x); if (__err_rc != ESP_OK) { printf("[%s] %s, err=%d\n", tag, msg, __err_rc); return __err_rc; } } while(0)
\ No newline at end of file
+#define ESP_RETURN_ON_ERROR(x, tag, msg) do { esp_err_t __err_rc = (x); if (__err_rc != ESP_OK) { printf("[%s] %s, err=%d\n", tag, msg, __err_rc); return __err_rc; } } while(0)
+
+// Fast-boot build profile (-DFAST_BOOT=1, applies sdkconfig.fastboot)
+#ifndef FAST_BOOT
+    #define FAST_BOOT 0
+#endif
+
+// Code that runs on every wake before the first sample. The fast-boot
+// profile places it in IRAM so it does not stall on flash cache misses.
+#if FAST_BOOT
+    #include "esp_attr.h"
+    #define FAST_BOOT_IRAM IRAM_ATTR
+#else
+    #define FAST_BOOT_IRAM
+#endif
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "common.h"
+#include "config.h"
+
+// Awake-time budget for a single wake cycle.
+//
+// The supervisor starts at boot with a budget chosen by wake cause. When the
+// budget runs out, cycle_supervisor_expired() turns true so the Wi-Fi, MQTT
+// and sampling wait loops give up early; if the cycle still has not reached
+// deep sleep CYCLE_BUDGET_GRACE_MS later, the supervisor stops Wi-Fi and
+// enters deep sleep itself. Overruns, error aborts and unexpected resets are
+// counted in RTC memory and reported with the next telemetry publish.
+
+// Budget when woken by the sleep timer (burst sampling + one publish)
+#ifndef CYCLE_BUDGET_TIMER_MS
+    #define CYCLE_BUDGET_TIMER_MS (BURST_DURATION_MS + 20000)
+#endif
+
+// Budget when woken by the wake circuit
+#ifndef CYCLE_BUDGET_WAKE_PIN_MS
+    #define CYCLE_BUDGET_WAKE_PIN_MS (BURST_DURATION_MS + 20000)
+#endif
+
+// Budget after power-up or reset (includes the diagnostic mode prompt)
+#ifndef CYCLE_BUDGET_FIRST_BOOT_MS
+    #define CYCLE_BUDGET_FIRST_BOOT_MS (BURST_DURATION_MS + 30000)
+#endif
+
+// Extra time granted to a cycle that downloads an OTA update
+#ifndef CYCLE_BUDGET_OTA_MS
+    #define CYCLE_BUDGET_OTA_MS 120000
+#endif
+
+// Time allowed for a graceful wind-down after the budget expires
+#ifndef CYCLE_BUDGET_GRACE_MS
+    #define CYCLE_BUDGET_GRACE_MS 2000
+#endif
+
+// In wake circuit mode we only wake once per heartbeat interval
+#define WAKE_CIRCUIT_SLEEP_TIME_SECONDS (HEARTBEAT_INTERVAL_HOURS * 3600)
+
+typedef enum {
+    CYCLE_PHASE_BOOT,
+    CYCLE_PHASE_SAMPLING,
+    CYCLE_PHASE_WIFI,
+    CYCLE_PHASE_MQTT,
+    CYCLE_PHASE_PUBLISH,
+    CYCLE_PHASE_SLEEP,
+    CYCLE_PHASE_OTA,
+} cycle_phase_t;
+
+typedef enum {
+    CYCLE_ABORT_NONE,
+    CYCLE_ABORT_BUDGET,     // Budget expired (detail: budget in ms)
+    CYCLE_ABORT_ERROR,      // Error check failed (detail: esp_err_t)
+    CYCLE_ABORT_RESET,      // Previous cycle ended in a reset (detail: esp_reset_reason_t)
+} cycle_abort_t;
+
+// Counters kept in RTC memory since power-up
+typedef struct {
+    uint32_t cycles;            // Wake cycles
+    uint16_t overruns;          // Cycles that exceeded their budget
+    uint16_t errors;            // Cycles aborted by CYCLE_CHECK
+    uint16_t resets;            // Panics, watchdog and brownout resets
+    uint8_t last_abort;         // cycle_abort_t of the most recent event
+    uint8_t last_phase;         // Phase active at the most recent event
+    int32_t last_detail;        // Budget, esp_err_t or reset reason
+    uint32_t last_awake_ms;     // Awake time of the previous cycle
+    uint32_t max_awake_ms;      // Longest awake time seen
+} cycle_stats_t;
+
+// Replacement for ESP_ERROR_CHECK on the wake cycle path: instead of
+// aborting (and rebooting into another full cycle), record the error and
+// go straight back to deep sleep
+#define CYCLE_CHECK(x) do {                                         \
+        esp_err_t __err_rc = (x);                                   \
+        if (__err_rc != ESP_OK) {                                   \
+            cycle_supervisor_abort(CYCLE_ABORT_ERROR, __err_rc);    \
+        }                                                           \
+    } while (0)
+
+// Start the budget timer; call at the start of app_main
+void cycle_supervisor_start(void);
+
+// Stop supervising (diagnostic mode runs without a budget)
+void cycle_supervisor_cancel(void);
+
+// Record the phase the cycle is in, for overrun reporting
+void cycle_supervisor_set_phase(cycle_phase_t phase);
+
+// Add extra_ms to the current budget (ignored once it has run out)
+void cycle_supervisor_extend(uint32_t extra_ms);
+
+// True once the budget has run out
+bool cycle_supervisor_expired(void);
+
+// Milliseconds left in the budget (0 once expired)
+int cycle_supervisor_remaining_ms(void);
+
+// Record an abort and go to deep sleep immediately
+void cycle_supervisor_abort(cycle_abort_t reason, int32_t detail) __attribute__((noreturn));
+
+// Configure wake-up sources and enter deep sleep (normal end of a cycle)
+void cycle_supervisor_sleep(void) __attribute__((noreturn));
+
+// Counters for telemetry
+const cycle_stats_t *cycle_supervisor_stats(void);
+
+// Name of a phase for telemetry
+const char *cycle_supervisor_phase_name(cycle_phase_t phase);
@@ -0,0 +1,86 @@
+#pragma once
+
+// Binary delta format for OTA updates.
+//
+// A delta rebuilds a new firmware image from the image the device is running
+// (the source) and is produced on the host by tools/ota_delta.py:
+//   header (delta_header_t)
+//   op stream, zlib-compressed when DELTA_FLAG_ZLIB is set:
+//     0x01 COPY    varint source_offset, varint length
+//     0x02 INSERT  varint length, then length literal bytes
+//     0x00 END
+// Varints are unsigned LEB128. The source is identified by the ELF SHA-256
+// embedded in its app description (esp_app_desc_t.app_elf_sha256), which is
+// at DELTA_APP_ELF_SHA256_OFFSET in the .bin file.
+//
+// delta_patch_feed() applies the (decompressed) op stream incrementally, so
+// it can be fed straight from a network download. Shared by the firmware
+// (ota_manager.c) and tools/delta_apply.c, so no ESP-IDF dependencies.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define DELTA_MAGIC "LDRD"
+#define DELTA_VERSION 1
+
+#define DELTA_FLAG_ZLIB 0x01      // Op stream is zlib-compressed
+
+// Image header (24) + first segment header (8) + offset in esp_app_desc_t
+#define DELTA_APP_ELF_SHA256_OFFSET 176
+
+#define DELTA_OP_END    0x00
+#define DELTA_OP_COPY   0x01
+#define DELTA_OP_INSERT 0x02
+
+typedef struct __attribute__((packed)) {
+    char magic[4];
+    uint8_t version;
+    uint8_t flags;
+    uint16_t reserved;
+    uint32_t source_size;         // Bytes of the source image COPY may read
+    uint32_t target_size;         // Size of the rebuilt image
+    uint8_t source_id[32];        // app_elf_sha256 of the source image
+    uint8_t target_sha256[32];    // SHA-256 of the rebuilt image
+} delta_header_t;
+
+typedef enum {
+    DELTA_OK = 0,                 // Input consumed, more expected
+    DELTA_DONE = 1,               // END op reached
+    DELTA_ERR_OP = -1,            // Unknown op or trailing data after END
+    DELTA_ERR_RANGE = -2,         // COPY outside the source or output too long
+    DELTA_ERR_READ = -3,          // Source read callback failed
+    DELTA_ERR_WRITE = -4,         // Output write callback failed
+} delta_result_t;
+
+// Read len bytes of the source image at offset; return 0 on success
+typedef int (*delta_read_fn)(void *ctx, uint32_t offset, uint8_t *buf, size_t len);
+
+// Append len bytes to the target image; return 0 on success
+typedef int (*delta_write_fn)(void *ctx, const uint8_t *data, size_t len);
+
+typedef struct {
+    delta_read_fn read;
+    delta_write_fn write;
+    void *ctx;
+    uint32_t source_size;
+    uint32_t target_size;
+    uint32_t written;             // Target bytes produced so far
+    uint8_t state;                // Parser state (see delta_patch.c)
+    uint8_t varint_shift;
+    uint32_t varint;
+    uint32_t copy_offset;
+    uint32_t remaining;           // Literal bytes left in the current INSERT
+    int result;                   // Sticky result once done or failed
+    uint8_t copy_buf[256];
+} delta_patch_t;
+
+// Start applying an op stream for the given header sizes
+void delta_patch_init(delta_patch_t *patch, uint32_t source_size, uint32_t target_size,
+                      delta_read_fn read, delta_write_fn write, void *ctx);
+
+// Apply the next len bytes of the op stream. Returns DELTA_OK while more
+// input is expected, DELTA_DONE after the END op, or a negative error
+int delta_patch_feed(delta_patch_t *patch, const uint8_t *data, size_t len);
+
+// Validate the fixed part of a header; returns 0 if usable
+int delta_header_check(const delta_header_t *header);
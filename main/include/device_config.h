@@ -0,0 +1,86 @@
+#pragma once
+
+#include "common.h"
+#include "esp_err.h"
+#include "config.h"
+
+// Per-device identity, provisioned into NVS over serial in diagnostic mode
+// (see tools/provision.py), so one firmware image can serve every trap.
+//
+// Provisioned keys (namespace DEVICE_CONFIG_NAMESPACE):
+//   id       trap ID; moves every topic under MQTT_TOPIC_PREFIX to
+//            MQTT_TOPIC_BASE "<id>"
+//   prefix   explicit replacement for MQTT_TOPIC_PREFIX (overrides id)
+//   avail    availability topic
+//   thrN     threshold of sensor table entry N
+//   topicN   state topic of sensor table entry N
+// Anything not provisioned falls back to the build's config.h, so an
+// unprovisioned device behaves exactly like a per-trap build.
+
+// RTC memory for the provisioned settings, so deep sleep wakes need not read
+// NVS; settings that do not fit are read from NVS on every wake instead
+#ifndef DEVICE_CONFIG_CACHE_SIZE
+    #define DEVICE_CONFIG_CACHE_SIZE 320
+#endif
+
+#define DEVICE_CONFIG_NAMESPACE "device"
+#define DEVICE_ID_MAX 32                // Including the terminator
+#define DEVICE_TOPIC_MAX 96             // Including the terminator
+
+#ifndef MQTT_TOPIC_BASE
+    #define MQTT_TOPIC_BASE "home/mousetrap/"
+#endif
+#ifndef MQTT_TOPIC_PREFIX
+    #define MQTT_TOPIC_PREFIX MQTT_TOPIC_BASE TRAP_ID
+#endif
+
+// Device-level topics (sensor state topics come from the sensor table)
+typedef enum {
+    DEVICE_TOPIC_AVAILABILITY,
+    DEVICE_TOPIC_TELEMETRY,
+    DEVICE_TOPIC_LOG,
+    DEVICE_TOPIC_LOG_REQUEST,
+    DEVICE_TOPIC_TRACE,
+    DEVICE_TOPIC_TRACE_REQUEST,
+    DEVICE_TOPIC_OTA,
+    DEVICE_TOPIC_OTA_DELTA,
+    DEVICE_TOPIC_OTA_STATUS,
+    DEVICE_TOPIC_TRIGGER,
+    DEVICE_TOPIC_COUNT
+} device_topic_t;
+
+// True if device_config_load can take the settings from RTC memory, i.e. on a
+// deep sleep wake after they were read from NVS
+bool device_config_cached(void);
+
+// Read the provisioned settings, from the RTC cache or else from NVS (which
+// must then be initialized). Falls back to the build defaults if nothing is
+// provisioned or NVS cannot be read.
+esp_err_t device_config_load(void);
+
+// True if any setting was read from NVS
+bool device_config_provisioned(void);
+
+// Trap ID in use (provisioned or TRAP_ID)
+const char *device_config_trap_id(void);
+
+// Topic in use for a device-level topic
+const char *device_config_topic(device_topic_t topic);
+
+// Threshold and state topic in use for sensor table entry index
+int device_config_sensor_threshold(int index, int default_threshold);
+const char *device_config_sensor_topic(int index, const char *default_topic);
+
+// Provisioning. Settings are validated and staged in RAM, then written to
+// NVS together by device_config_commit; they take effect after a restart.
+// Returns ESP_ERR_INVALID_ARG for an unknown key or an invalid value.
+esp_err_t device_config_set(const char *key, const char *value);
+
+// Stage removal of every provisioned setting (before any set after it)
+esp_err_t device_config_erase(void);
+
+// Write the staged changes to NVS
+esp_err_t device_config_commit(void);
+
+// Drop the staged changes without writing them
+void device_config_discard(void);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "common.h"
+#include "trace_format.h"
+#include "esp_adc/adc_oneshot.h"
+#include "driver/uart.h"
+#include "config.h"
+
+// Console UART used for diagnostic commands and binary streaming
+#define STREAM_UART UART_NUM_0
+
+// Per-channel sample rate while streaming. At the default 115200 baud the
+// link carries roughly 2500 two-channel samples per second; lower the rate
+// when the sensor table has more channels.
+#ifndef STREAM_SAMPLE_RATE_HZ
+    #define STREAM_SAMPLE_RATE_HZ 1000
+#endif
+
+// Samples per packet (max 255)
+#ifndef STREAM_PACKET_COUNT
+    #define STREAM_PACKET_COUNT 32
+#endif
+
+// Install the UART driver so diagnostic mode can receive host commands
+esp_err_t diag_stream_init(void);
+
+// Stream framed sample packets (one channel per sensor table entry, plus
+// LDR1 and the wake pin bit in wake circuit mode) over the console UART
+// until the host sends STREAM_CMD_STOP
+void diag_stream_run(adc_oneshot_unit_handle_t adc1_handle);
@@ -5,6 +5,14 @@
 #include "esp_log.h"
 #include "driver/gpio.h"
 
+// Host command that starts provisioning the device config (see
+// tools/provision.py). Sent during the power-up countdown, it also enters
+// diagnostic mode, so devices can be provisioned without pressing the button.
+#define DIAG_CMD_PROVISION 'p'
+
+// How long provisioning waits for each line from the host
+#define PROVISION_LINE_TIMEOUT_MS 10000
+
 // Run diagnostic mode
 void diagnostic_mode_run(adc_oneshot_unit_handle_t adc1_handle);
 
@@ -6,7 +6,8 @@
 #include "esp_log.h"
 #include "led_strip.h"
 
-// Initialize LED GPIO
+// Initialize the LED driver. Called by the functions below on first use, so
+// wake cycles that never touch the LED skip the RMT setup
 esp_err_t led_controller_init(void);
 
 // Set LED state for diagnostic mode
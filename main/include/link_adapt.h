@@ -0,0 +1,77 @@
+#pragma once
+
+#include "common.h"
+#include "config.h"
+
+// Wi-Fi link adaptation: picks the lowest TX power and the 802.11 mode that
+// still connect reliably, from the connect results and RSSI of past wakes.
+//
+// Levels run from the most economical to the most robust:
+//   0  8 dBm  11b/g/n        3  17 dBm  11b/g/n
+//   1  11 dBm 11b/g/n        4  20 dBm  11b/g/n (start level)
+//   2  14 dBm 11b/g/n        5  20 dBm  11b only (if LINK_ADAPT_11B_ONLY)
+// A failed connect steps one level up straight away and holds off the next
+// step down for LINK_ADAPT_HOLD_SESSIONS. After LINK_ADAPT_STEP_DOWN_AFTER
+// connects in a row, the level steps down if the averaged RSSI, reduced by
+// the TX power given up, stays above LINK_ADAPT_MIN_RSSI (the path loss is
+// about the same both ways, so the AP hears us that much weaker).
+//
+// Connect history is kept in RTC memory; the level is also stored in NVS so
+// it survives a battery change. The chosen settings are reported in telemetry.
+
+// Set to 0 to always use full TX power and 11b/g/n
+#ifndef LINK_ADAPT_ENABLE
+    #define LINK_ADAPT_ENABLE 1
+#endif
+
+// Weakest expected uplink RSSI (dBm) for stepping down in TX power
+#ifndef LINK_ADAPT_MIN_RSSI
+    #define LINK_ADAPT_MIN_RSSI -72
+#endif
+
+// Connects in a row at one level before trying the next lower one
+#ifndef LINK_ADAPT_STEP_DOWN_AFTER
+    #define LINK_ADAPT_STEP_DOWN_AFTER 8
+#endif
+
+// Extra connects required before stepping down again after a failure
+#ifndef LINK_ADAPT_HOLD_SESSIONS
+    #define LINK_ADAPT_HOLD_SESSIONS 24
+#endif
+
+// Allow the top level to restrict the link to 802.11b (long range DSSS
+// rates); set to 0 if the access point has 11b rates disabled
+#ifndef LINK_ADAPT_11B_ONLY
+    #define LINK_ADAPT_11B_ONLY 1
+#endif
+
+#define LINK_ADAPT_NAMESPACE "link"
+
+// Link statistics kept in RTC memory since power-up
+typedef struct {
+    uint8_t level;              // Level in use
+    int8_t tx_dbm;              // TX power of the level
+    uint8_t protocol;           // WIFI_PROTOCOL_* bit mask of the level
+    int8_t last_rssi;           // RSSI of the last successful connect (0 if none)
+    int16_t rssi_avg_x16;       // Averaged RSSI x16 (0 until the first connect)
+    int16_t streak;             // Connects in a row at this level (negative while held)
+    uint8_t history;            // Last 8 connect results, bit 0 newest (1 = connected)
+    uint8_t attempts;           // Connect results in history (up to 8)
+    uint16_t failures;          // Failed connects
+    uint16_t steps_up;          // Level changes towards more robust
+    uint16_t steps_down;        // Level changes towards more economical
+    uint32_t last_connect_ms;   // Wi-Fi start to IP address, last connect
+} link_adapt_stats_t;
+
+// Apply the current level's protocol (call before esp_wifi_start) and TX
+// power (call after esp_wifi_start): link_adapt_apply(false), then (true)
+void link_adapt_apply(bool started);
+
+// Record the outcome of this wake's connect and choose the next level
+void link_adapt_record(bool connected, int rssi, uint32_t connect_ms);
+
+// Statistics and current level
+const link_adapt_stats_t *link_adapt_stats(void);
+
+// Protocol of the current level as text ("bgn" or "b")
+const char *link_adapt_protocol_name(void);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "common.h"
+#include "config.h"
+
+// Heap and stack high-water marks, kept in RTC memory since power-up and
+// reported with telemetry. Use them to size LOW_MEMORY_MODE buffers and
+// task stacks (sdkconfig.lowmem) with a known margin.
+
+// Tasks whose stack high-water mark is tracked (IDF task names)
+#define MEM_STATS_TASKS(X) \
+    X(MAIN,   "main")      \
+    X(MQTT,   "mqtt_task") \
+    X(TCPIP,  "tiT")       \
+    X(WIFI,   "wifi")      \
+    X(EVENT,  "sys_evt")   \
+    X(TIMER,  "esp_timer")
+
+#define MEM_STATS_TASK_ENUM(name, str) MEM_STATS_TASK_##name,
+
+typedef enum {
+    MEM_STATS_TASKS(MEM_STATS_TASK_ENUM)
+    MEM_STATS_TASK_COUNT
+} mem_stats_task_t;
+
+typedef struct {
+    uint32_t heap_min_free;         // Lowest free heap since power-up (bytes)
+    uint32_t heap_min_free_cycle;   // Lowest free heap in the last sampled cycle
+    uint32_t heap_largest_block;    // Largest free block at the last sample
+    uint16_t stack_min_free[MEM_STATS_TASK_COUNT];  // Lowest unused stack per task (bytes, 0 = not seen yet)
+} mem_stats_t;
+
+// Fold the current heap minimum and the high-water marks of the tracked
+// tasks that exist right now into the RTC statistics
+void mem_stats_sample(void);
+
+// Statistics for telemetry
+const mem_stats_t *mem_stats_get(void);
+
+// IDF name of a tracked task
+const char *mem_stats_task_name(mem_stats_task_t task);
@@ -4,6 +4,37 @@
 #include "mqtt_client.h"
 #include "esp_log.h"
 #include "esp_event.h"
+#include "mqtt_tls.h"
+
+// Build mode with pre-sized MQTT buffers and trimmed network stack, set by
+// building with -DLOW_MEMORY_MODE=1 (which also applies sdkconfig.lowmem)
+#ifndef LOW_MEMORY_MODE
+    #define LOW_MEMORY_MODE 0
+#endif
+
+// MQTT client sizing used in LOW_MEMORY_MODE. Messages larger than the
+// buffer are still sent, in buffer-sized pieces; the outbox must hold every
+// QoS 1 message of a wake until it is acknowledged (log and trace uploads
+// included).
+#ifndef MQTT_BUFFER_SIZE
+    #define MQTT_BUFFER_SIZE 512
+#endif
+#ifndef MQTT_OUTBOX_LIMIT
+    #define MQTT_OUTBOX_LIMIT 4096
+#endif
+#ifndef MQTT_TASK_STACK_SIZE
+    #if MQTT_USE_TLS
+        #define MQTT_TASK_STACK_SIZE 6144  // The TLS handshake runs in the MQTT task
+    #else
+        #define MQTT_TASK_STACK_SIZE 3072
+    #endif
+#endif
+
+// Time to wait for the PUBACK of a log or trace upload before keeping the
+// buffer for the next attempt
+#ifndef MQTT_UPLOAD_ACK_TIMEOUT_MS
+    #define MQTT_UPLOAD_ACK_TIMEOUT_MS 5000
+#endif
 
 // MQTT client handle
 extern esp_mqtt_client_handle_t mqtt_client;
@@ -18,5 +49,45 @@ void mqtt_manager_event_handler(void *handler_args, esp_event_base_t base,
 // Publish message with retries
 bool mqtt_manager_publish(const char *topic, const char *message, int qos, int retain);
 
+// Publish with QoS 1 and remember the message ID, so the time of its PUBACK
+// can be read with mqtt_manager_wait_acked
+bool mqtt_manager_publish_tracked(const char *topic, const char *message, int retain);
+
+// Tracked publish of a binary payload of the given length (0 for a string)
+bool mqtt_manager_publish_data_tracked(const char *topic, const void *data, size_t len, int retain);
+
+// Wait up to timeout_ms for the PUBACK of the last tracked publish. Returns
+// the esp_timer time (us) the PUBACK arrived, or -1 if it did not arrive.
+int64_t mqtt_manager_wait_acked(int timeout_ms);
+
+// Publish a binary payload of the given length
+bool mqtt_manager_publish_data(const char *topic, const void *data, size_t len, int qos, int retain);
+
+// Receives a retained message piece by piece, as the client buffers it:
+// offset counts from the start of the payload and total is its full length.
+// Runs in the MQTT task. Return false to abandon the message.
+typedef bool (*mqtt_stream_cb_t)(void *ctx, const uint8_t *data, size_t len, size_t offset, size_t total);
+
+// Subscribe to topic and pass its retained message to cb, waiting up to
+// timeout_ms for all of it. Returns the payload length, or -1 if no complete
+// retained message was received (or cb abandoned it).
+int mqtt_manager_stream_retained(const char *topic, mqtt_stream_cb_t cb, void *ctx, int timeout_ms);
+
+// Most topics checked with one subscription
+#define MQTT_RETAINED_MAX 4
+
+// A retained request topic for mqtt_manager_fetch_requests
+typedef struct {
+    const char *topic;
+    char *buf;                  // Payload, NUL-terminated (truncated to fit)
+    size_t buf_len;             // Must be at least 1
+    int len;                    // Set to the payload length, or -1 if none
+} mqtt_request_t;
+
+// Check several retained request topics at once: one SUBSCRIBE with every
+// topic and a single wait for the retained messages, instead of one round
+// trip per topic. Up to MQTT_RETAINED_MAX topics.
+void mqtt_manager_fetch_requests(mqtt_request_t *requests, int count, int timeout_ms);
+
 // Stop and cleanup MQTT client
 void mqtt_manager_cleanup(void);
\ No newline at end of file
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "common.h"
+#include "config.h"
+#include "esp_transport.h"
+
+// MQTT over TLS with session resumption across deep sleep.
+//
+// A full TLS handshake (certificate chain verification plus an ECDHE key
+// exchange) takes seconds on an 80 MHz ESP32-C3. After each successful
+// handshake the negotiated session (session ID and, if the broker issues
+// one, its session ticket) is serialized into RTC memory, so the next wake
+// can offer it and do an abbreviated handshake without any public key
+// operations. If the broker no longer accepts the session, the handshake
+// simply falls back to a full one.
+
+// Set to 1 to connect with mqtts:// (requires MQTT_CA_CERT in secrets.h)
+#ifndef MQTT_USE_TLS
+    #define MQTT_USE_TLS 0
+#endif
+
+// RTC memory reserved for the cached session. A TLS 1.2 session with a
+// ticket fits in 512 bytes as long as CONFIG_MBEDTLS_SSL_KEEP_PEER_CERTIFICATE
+// is disabled; with it enabled the broker certificate is stored as well.
+#ifndef MQTT_TLS_SESSION_SIZE
+    #define MQTT_TLS_SESSION_SIZE 512
+#endif
+
+// Handshake statistics kept in RTC memory since power-up
+typedef struct {
+    uint16_t full;              // Full handshakes
+    uint16_t resumed;           // Abbreviated (resumed) handshakes
+    uint16_t failed;            // Failed handshakes
+    bool last_resumed;          // Whether the most recent handshake was resumed
+    uint32_t last_ms;           // Duration of the most recent handshake
+    uint32_t last_full_ms;      // Duration of the most recent full handshake
+    uint32_t last_resumed_ms;   // Duration of the most recent resumed handshake
+} mqtt_tls_stats_t;
+
+// Create the TLS transport for esp_mqtt_client_config_t.network.transport
+// (the MQTT client destroys it in esp_mqtt_client_destroy)
+esp_transport_handle_t mqtt_tls_transport_create(void);
+
+// Drop the cached session so the next connection does a full handshake
+void mqtt_tls_forget_session(void);
+
+// Handshake statistics for telemetry
+const mqtt_tls_stats_t *mqtt_tls_stats(void);
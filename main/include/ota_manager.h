@@ -0,0 +1,65 @@
+#pragma once
+
+#include "common.h"
+#include "config.h"
+
+// Delta OTA updates, pulled during heartbeat publish sessions.
+//
+// The retained request on MQTT_TOPIC_OTA names the version to run and where
+// to get the delta from the running image (see tools/ota_delta.py):
+//   "<version> http://host:port/path.ldrd"   download over HTTP
+//   "<version> mqtt"                          retained on MQTT_TOPIC_OTA_DELTA
+// If the version differs from the running one, the delta is applied into the
+// inactive OTA partition as it downloads and the device restarts into it. The
+// new image must publish on its first boot, retrying the connection for up
+// to CYCLE_BUDGET_OTA_MS, or the bootloader rolls back to the previous one.
+// A rolled-back version is requested again by clearing or changing the
+// request. Progress is reported on MQTT_TOPIC_OTA_STATUS.
+
+// Set to 0 to leave out OTA support
+#ifndef OTA_ENABLE
+    #define OTA_ENABLE 1
+#endif
+
+#ifndef MQTT_TOPIC_OTA
+    #define MQTT_TOPIC_OTA "home/mousetrap/" TRAP_ID "/ota"
+#endif
+
+#ifndef MQTT_TOPIC_OTA_DELTA
+    #define MQTT_TOPIC_OTA_DELTA "home/mousetrap/" TRAP_ID "/ota/delta"
+#endif
+
+#ifndef MQTT_TOPIC_OTA_STATUS
+    #define MQTT_TOPIC_OTA_STATUS "home/mousetrap/" TRAP_ID "/ota/status"
+#endif
+
+// Timeout for connecting to and reading from the HTTP server
+#ifndef OTA_HTTP_TIMEOUT_MS
+    #define OTA_HTTP_TIMEOUT_MS 10000
+#endif
+
+// Pause between connection attempts on the first boot of an updated image
+#ifndef OTA_CONFIRM_RETRY_MS
+    #define OTA_CONFIRM_RETRY_MS 5000
+#endif
+
+// Longest request on MQTT_TOPIC_OTA, including the terminator
+#define OTA_REQUEST_MAX 192
+
+// Install the update asked for by request, the retained payload of
+// MQTT_TOPIC_OTA (NULL if none). Call with MQTT connected; returns true if a
+// new image was installed and the device should restart once the session is
+// closed
+bool ota_manager_check(const char *request);
+
+// True on the first boot of an updated image, until it is confirmed
+bool ota_manager_pending_verify(void);
+
+// On the first boot of an updated image: call with published = true while
+// still connected once the states are out, to keep the image and report it,
+// or with false when no connection could be made, to roll back and restart
+// into the previous image. Does nothing on other boots
+void ota_manager_confirm(bool published);
+
+// Version string of the running image
+const char *ota_manager_running_version(void);
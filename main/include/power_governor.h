@@ -0,0 +1,102 @@
+#pragma once
+
+#include "common.h"
+#include "esp_adc/adc_oneshot.h"
+#include "config.h"
+
+// Supply voltage monitoring and energy-budget governor.
+//
+// The device's own supply is read once per wake through a resistor divider
+// on a spare ADC1 channel and filtered across wakes in RTC memory. As the
+// filtered voltage falls through the stage thresholds, the governor trades
+// heartbeats, burst length, connection retries and optional uploads for
+// battery life, so trap triggers keep being reported for as long as
+// possible. The stage is reported in telemetry.
+//
+//   stage     heartbeat  burst  retries  trace/log upload, OTA
+//   normal    x1         100%   100%     yes
+//   conserve  x2         75%    75%      yes
+//   low       x4         50%    50%      no
+//   critical  x8         25%    34%      no
+//
+// State changes are always published immediately, in every stage.
+
+// Set to 1 once the divider is fitted (supply -> R1 -> SUPPLY_ADC_CHANNEL -> R2 -> GND)
+#ifndef SUPPLY_MONITOR_ENABLE
+    #define SUPPLY_MONITOR_ENABLE 0
+#endif
+
+#ifndef SUPPLY_ADC_CHANNEL
+    #define SUPPLY_ADC_CHANNEL ADC_CHANNEL_0    // GPIO0
+#endif
+
+// Supply voltage per ADC pin voltage, x1000: (R1 + R2) / R2, 2000 for two equal resistors
+#ifndef SUPPLY_DIVIDER_RATIO_X1000
+    #define SUPPLY_DIVIDER_RATIO_X1000 2000
+#endif
+
+// Readings averaged per wake
+#ifndef SUPPLY_SAMPLES
+    #define SUPPLY_SAMPLES 8
+#endif
+
+// Weight of each wake's reading in the filtered voltage: 1 / 2^SUPPLY_FILTER_SHIFT
+#ifndef SUPPLY_FILTER_SHIFT
+    #define SUPPLY_FILTER_SHIFT 2
+#endif
+
+// Filtered supply voltage below which each stage starts
+#ifndef SUPPLY_CONSERVE_MV
+    #define SUPPLY_CONSERVE_MV 3600
+#endif
+#ifndef SUPPLY_LOW_MV
+    #define SUPPLY_LOW_MV 3450
+#endif
+#ifndef SUPPLY_CRITICAL_MV
+    #define SUPPLY_CRITICAL_MV 3300
+#endif
+
+// Rise above a stage threshold needed to return to the previous stage
+#ifndef SUPPLY_HYSTERESIS_MV
+    #define SUPPLY_HYSTERESIS_MV 50
+#endif
+
+// Shortest burst the governor will use (the trap LED must still be caught)
+#ifndef POWER_MIN_BURST_MS
+    #define POWER_MIN_BURST_MS 3000
+#endif
+
+typedef enum {
+    POWER_STAGE_NORMAL,
+    POWER_STAGE_CONSERVE,
+    POWER_STAGE_LOW,
+    POWER_STAGE_CRITICAL,
+    POWER_STAGE_COUNT
+} power_stage_t;
+
+// Measure the supply, update the filtered voltage and choose the stage for
+// this wake (call once after sensor_manager_init; does nothing without
+// SUPPLY_MONITOR_ENABLE)
+void power_governor_update(adc_oneshot_unit_handle_t adc1_handle);
+
+// Stage in effect for this wake
+power_stage_t power_governor_stage(void);
+
+// Name of a stage for telemetry
+const char *power_governor_stage_name(power_stage_t stage);
+
+// Last reading and filtered supply voltage in mV (0 if not measured)
+int power_governor_supply_mv(void);
+int power_governor_filtered_mv(void);
+
+// Heartbeat interval multiplier for this stage
+int power_governor_heartbeat_scale(void);
+
+// Burst duration for this stage
+int power_governor_burst_ms(void);
+
+// Connection wait loops scaled for this stage (at least 1)
+int power_governor_retries(int max_retries);
+
+// True if trace and log uploads and OTA checks are allowed in this stage
+bool power_governor_allow_optional(void);
@@ -0,0 +1,27 @@
+#pragma once
+
+// Decides what a wake cycle publishes, shared by the firmware (main.c) and
+// the host-side benchmark (tools/replay_bench.c). Keep this free of ESP-IDF
+// dependencies so it builds with a plain host compiler.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    bool first_boot;                // First cycle since power-up
+    bool heartbeat_due;             // Heartbeat forced by the wake source
+    unsigned cycles_since_publish;  // Cycles since the last session, including this one
+    unsigned cycles_for_publish;    // Heartbeat interval in cycles
+} publish_context_t;
+
+typedef struct {
+    bool connect;                   // Start a WiFi/MQTT session
+    bool publish_all;               // Publish every sensor (first boot or heartbeat)
+    bool heartbeat;                 // Heartbeat due (also uploads burst traces)
+    uint32_t publish_mask;          // Sensor table entries to publish
+} publish_decision_t;
+
+// Compare the current sensor states with the last published ones. A session
+// is started when any state changed or a full publish is due.
+publish_decision_t publish_policy_decide(const publish_context_t *ctx, const bool *state,
+                                         const bool *last_state, int count);
@@ -0,0 +1,23 @@
+#pragma once
+
+// Sample accumulation and classification shared by the firmware and the
+// host-side tools (tools/trace_replay.c). Keep this free of ESP-IDF
+// dependencies so it builds with a plain host compiler.
+
+#include <stdbool.h>
+
+#define SENSOR_ADC_MAX 4095
+
+typedef struct {
+    int max_value;      // Highest value seen during burst
+    int min_value;      // Lowest value seen during burst
+} sensor_data_t;
+
+// Reset min/max before a new burst
+void sensor_data_reset(sensor_data_t *data);
+
+// Fold one ADC reading into the burst statistics
+void sensor_data_add_sample(sensor_data_t *data, int reading);
+
+// True if the LED was seen lit at any point during the burst
+bool sensor_data_above_threshold(const sensor_data_t *data, int threshold);
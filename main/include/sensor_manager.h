@@ -1,28 +1,113 @@
 #pragma once
 
 #include "common.h"
+#include "sensor_classify.h"
+#include "trace_codec.h"
 #include "esp_adc/adc_oneshot.h"
 #include "esp_log.h"
+#include "config.h"
+
+// Burst trace recording. Each burst is decimated (peak-hold over
+// TRACE_DECIMATION samples, so short LED blinks survive) and delta/varint
+// encoded into a ring of records in RTC memory.
+#ifndef TRACE_BUFFER_SIZE
+    #define TRACE_BUFFER_SIZE 2048      // Bytes of RTC memory for encoded traces
+#endif
+#ifndef TRACE_DECIMATION
+    #define TRACE_DECIMATION 5          // Firmware samples per trace sample
+#endif
+
+// Traces are uploaded on heartbeat publishes (if TRACE_UPLOAD_ON_HEARTBEAT)
+// or when a retained non-empty message is set on the request topic
+#ifndef TRACE_UPLOAD_ON_HEARTBEAT
+    #define TRACE_UPLOAD_ON_HEARTBEAT 1
+#endif
+#ifndef MQTT_TOPIC_TRACE
+    #define MQTT_TOPIC_TRACE "home/mousetrap/" TRAP_ID "/trace"
+#endif
+#ifndef MQTT_TOPIC_TRACE_REQUEST
+    #define MQTT_TOPIC_TRACE_REQUEST "home/mousetrap/" TRAP_ID "/trace/request"
+#endif
+
+// Upper bound on sensor table entries (one trace channel bit each)
+#define SENSOR_MAX_CHANNELS TRACE_CODEC_MAX_CHANNELS
+
+typedef enum {
+    SENSOR_ROLE_TRAP,           // Publishes "triggered" / "ready"
+    SENSOR_ROLE_BATTERY,        // Publishes "low" / "ok"
+} sensor_role_t;
+
+typedef enum {
+    SENSOR_SOURCE_ADC,          // LDR on an ADC1 channel
+    SENSOR_SOURCE_WAKE_PIN,     // Wake circuit comparator on a GPIO (reads 0 or SENSOR_ADC_MAX)
+} sensor_source_t;
 
 typedef struct {
-    int max_value;      // Highest value seen during burst
-    int min_value;      // Lowest value seen during burst
-} sensor_data_t;
+    sensor_role_t role;
+    sensor_source_t source;
+    int channel;                // adc_channel_t for ADC sources, gpio_num_t for wake pins
+    int threshold;              // Active when the burst maximum is above this value
+    const char *topic;          // MQTT state topic
+} sensor_config_t;
+
+// Sensor table: one entry per monitored LED, all sampled in the same burst
+// and published in the same MQTT session. Defaults to the classic
+// single-trap layout; override in config.h to watch several traps from one
+// device, e.g.
+/*
+    #define SENSOR_TABLE \
+        { SENSOR_ROLE_TRAP, SENSOR_SOURCE_ADC, ADC_CHANNEL_4, 50, "home/mousetrap/left/state" }, \
+        { SENSOR_ROLE_TRAP, SENSOR_SOURCE_ADC, ADC_CHANNEL_3, 50, "home/mousetrap/right/state" }, \
+        { SENSOR_ROLE_BATTERY, SENSOR_SOURCE_ADC, ADC_CHANNEL_1, 200, "home/mousetrap/left/battery" }
+*/
+#ifndef SENSOR_TABLE
+    #if USE_WAKE_CIRCUIT
+        #define SENSOR_TABLE \
+            { SENSOR_ROLE_TRAP, SENSOR_SOURCE_WAKE_PIN, WAKE_PIN, TRAP_THRESHOLD, MQTT_TOPIC_CAUGHT }, \
+            { SENSOR_ROLE_BATTERY, SENSOR_SOURCE_ADC, LDR2_ADC_CHANNEL, BATTERY_THRESHOLD, MQTT_TOPIC_BATTERY }
+    #else
+        #define SENSOR_TABLE \
+            { SENSOR_ROLE_TRAP, SENSOR_SOURCE_ADC, LDR1_ADC_CHANNEL, TRAP_THRESHOLD, MQTT_TOPIC_CAUGHT }, \
+            { SENSOR_ROLE_BATTERY, SENSOR_SOURCE_ADC, LDR2_ADC_CHANNEL, BATTERY_THRESHOLD, MQTT_TOPIC_BATTERY }
+    #endif
+#endif
 
-// Initialize ADC and sensor configurations
+// Initialize ADC and sensor configurations, applying the provisioned
+// thresholds and topics (call after device_config_load)
 esp_err_t sensor_manager_init(adc_oneshot_unit_handle_t *adc1_handle);
 
-// Perform burst sampling of sensors
-void sensor_manager_burst_sample(adc_oneshot_unit_handle_t adc1_handle,
-                               sensor_data_t *sensor1,
-                               sensor_data_t *sensor2);
+// Number of entries in the sensor table
+int sensor_manager_count(void);
+
+// Sensor table entry
+const sensor_config_t *sensor_manager_get(int index);
+
+// Single reading of one sensor (0..SENSOR_ADC_MAX, 0 if the read fails)
+int sensor_manager_read(adc_oneshot_unit_handle_t adc1_handle, int index);
+
+// Burst-sample every sensor in the table; data holds one entry per sensor
+void sensor_manager_burst_sample(adc_oneshot_unit_handle_t adc1_handle, sensor_data_t *data);
+
+// Count a wake-up from the wake circuit as a trigger of the wake pin sensors
+// in gpio_mask (even if the pin has dropped again). Returns a bit mask of the
+// sensor indexes that were marked.
+uint32_t sensor_manager_mark_woken(uint64_t gpio_mask, sensor_data_t *data);
+
+// GPIO mask of all wake pin sensors, for deep sleep wake-up
+uint64_t sensor_manager_wake_pin_mask(void);
+
+// Check if a sensor is active (trap triggered, battery low) based on its burst data
+bool sensor_manager_is_active(int index, const sensor_data_t *data);
+
+// MQTT payload for a sensor state
+const char *sensor_manager_state_payload(int index, bool active);
 
-// Sample only the battery sensor (for wake circuit mode)
-void sensor_manager_sample_battery(adc_oneshot_unit_handle_t adc1_handle,
-                                 sensor_data_t *sensor2);
+// Size of the blob sensor_manager_trace_snapshot would produce (0 if empty)
+size_t sensor_manager_trace_size(void);
 
-// Check if trap is triggered based on sensor data
-bool sensor_manager_is_trap_triggered(const sensor_data_t *sensor_data);
+// Copy the buffered burst traces (oldest first) into out as an upload blob.
+// Returns the number of bytes written, or 0 if empty or out is too small.
+size_t sensor_manager_trace_snapshot(uint8_t *out, size_t out_len);
 
-// Check if battery is low based on sensor data
-bool sensor_manager_is_battery_low(const sensor_data_t *sensor_data);
\ No newline at end of file
+// Discard buffered traces
+void sensor_manager_trace_clear(void);
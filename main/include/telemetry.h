@@ -0,0 +1,14 @@
+#pragma once
+
+#include "common.h"
+#include "config.h"
+
+// Device health telemetry, published as one retained JSON message per
+// publishing session (e.g. for Home Assistant MQTT sensors with
+// value_template: "{{ value_json.last_awake_ms }}")
+#ifndef MQTT_TOPIC_TELEMETRY
+    #define MQTT_TOPIC_TELEMETRY "home/mousetrap/" TRAP_ID "/telemetry"
+#endif
+
+// Build and publish the telemetry message (MQTT must be connected)
+bool telemetry_publish(void);
@@ -0,0 +1,62 @@
+#pragma once
+
+// Compact encoding of decimated burst traces.
+//
+// Each burst becomes one record:
+//   uint16 record_len     total record size in bytes, including this field
+//   uint16 burst_seq      running burst counter
+//   uint8  channel_mask   bit n = sensor table entry n (in the default
+//                         table, bit 0 = trap, bit 1 = battery)
+//   uint8  decimation     firmware samples folded into each trace sample
+//   uint16 interval_ms    firmware sample interval
+//   uint16 sample_count
+//   varint values         per sample, per channel in mask order: zigzag
+//                         encoded delta from that channel's previous value
+//                         (the first delta is from 0)
+//
+// Uploaded blobs are a trace_blob_header_t followed by records, oldest first,
+// and are decoded by tools/trace_decode.py. No ESP-IDF dependencies.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define TRACE_CODEC_MAX_CHANNELS 8
+#define TRACE_RECORD_HEADER_SIZE 10
+#define TRACE_BLOB_MAGIC 0x5A52444C  // "LDRZ"
+#define TRACE_BLOB_VERSION 1
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t records;
+    uint16_t length;        // Bytes of record data following the header
+} trace_blob_header_t;
+
+typedef struct {
+    uint8_t *buf;
+    size_t cap;
+    size_t len;
+    int channels;
+    int prev[TRACE_CODEC_MAX_CHANNELS];
+    uint16_t samples;
+    bool full;
+} trace_encoder_t;
+
+// Start a record in buf (cap bytes)
+void trace_encoder_begin(trace_encoder_t *enc, uint8_t *buf, size_t cap,
+                         uint16_t burst_seq, uint8_t channel_mask,
+                         uint8_t decimation, uint16_t interval_ms);
+
+// Append one sample (one value per channel in mask order). Returns false and
+// drops the sample once the buffer is full.
+bool trace_encoder_add(trace_encoder_t *enc, const int *values);
+
+// Finalize the record header; returns the record length
+size_t trace_encoder_finish(trace_encoder_t *enc);
+
+// Length of the record starting at rec
+static inline size_t trace_record_len(const uint8_t *rec)
+{
+    return rec[0] | (rec[1] << 8);
+}
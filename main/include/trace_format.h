@@ -0,0 +1,78 @@
+#pragma once
+
+// Wire and file formats for high-rate sensor traces.
+//
+// In diagnostic mode the firmware streams framed packets over the console
+// UART (see diag_stream.c); tools/trace_capture.py validates them and writes
+// the samples to a .ldrt trace file, which tools/trace_replay.c feeds back
+// through the firmware's classification code. Shared by firmware and host
+// tools, so no ESP-IDF dependencies. All multi-byte fields are little-endian.
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ---------------------------------------------------------------------------
+// Stream packet:
+//   header (stream_packet_header_t)
+//   count * channels uint16 samples, channel-interleaved
+//   uint16 CRC-16/CCITT-FALSE over everything after the sync bytes
+// ---------------------------------------------------------------------------
+
+#define STREAM_SYNC0 0xA5
+#define STREAM_SYNC1 0x5A
+
+#define STREAM_PACKET_SAMPLES 1   // Packet type: sample block
+
+#define STREAM_FLAG_DROPPED 0x01  // Samples were lost before this packet
+
+// Host -> device commands (single bytes) accepted in diagnostic mode
+#define STREAM_CMD_START 's'
+#define STREAM_CMD_STOP  'q'
+
+// Each sample value is a 12-bit ADC reading; bit 15 of a wake pin sensor's
+// channel carries the level of its GPIO
+#define TRACE_SAMPLE_VALUE_MASK 0x0FFF
+#define TRACE_SAMPLE_WAKE_PIN   0x8000
+
+typedef struct __attribute__((packed)) {
+    uint8_t sync[2];
+    uint8_t type;
+    uint8_t channels;
+    uint8_t count;
+    uint8_t flags;
+    uint16_t seq;
+    uint32_t t0_us;         // Timestamp of first sample (low 32 bits of esp_timer)
+    uint16_t period_us;     // Sample period
+} stream_packet_header_t;
+
+// ---------------------------------------------------------------------------
+// Trace file (.ldrt):
+//   header (trace_file_header_t)
+//   sample_count * channels uint16 samples, channel-interleaved
+// ---------------------------------------------------------------------------
+
+#define TRACE_FILE_MAGIC "LDRT"
+#define TRACE_FILE_VERSION 1
+
+#define TRACE_FLAG_GAPS 0x01      // Capture lost samples (see capture log)
+
+typedef struct __attribute__((packed)) {
+    char magic[4];
+    uint16_t version;
+    uint8_t channels;
+    uint8_t flags;
+    uint32_t sample_rate_hz;
+    uint32_t sample_count;
+} trace_file_header_t;
+
+// CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF)
+static inline uint16_t trace_crc16(uint16_t crc, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "common.h"
+#include "config.h"
+
+// Trigger timestamps and end-to-end latency for wake pin sensors.
+//
+// When a wake circuit sensor wakes the device, the wake stub's RTC timestamp
+// (see boot_timing.h) is taken as the moment the trap fired. The state
+// publish is tracked until its PUBACK, and the trigger-to-PUBACK latency is
+// added to a histogram in RTC memory. A retained JSON event is then published
+// on MQTT_TOPIC_TRIGGER:
+//   {"sensors":1,"rtc_ms":7261034,"age_ms":15872,"latency_ms":15790,
+//    "boot_ms":212,"count":3,"min_ms":14980,"avg_ms":15402,"max_ms":15790,
+//    "histogram":{"1000":0,"2000":0,...,"64000":0,"inf":0}}
+// rtc_ms is the trigger time on the RTC clock (milliseconds since power-on),
+// age_ms how long before this message was sent the trap fired, so the
+// receiver can place the event in wall-clock time. Histogram keys are bucket
+// upper bounds in milliseconds.
+
+#ifndef MQTT_TOPIC_TRIGGER
+    #define MQTT_TOPIC_TRIGGER "home/mousetrap/" TRAP_ID "/trigger"
+#endif
+
+// Time to wait for the PUBACK of the state publish
+#ifndef TRIGGER_PUBACK_TIMEOUT_MS
+    #define TRIGGER_PUBACK_TIMEOUT_MS 5000
+#endif
+
+// Histogram buckets: below 1s, 2s, 4s ... 64s, and anything longer
+#define TRIGGER_LATENCY_BUCKETS 8
+
+// Latency statistics kept in RTC memory since power-up
+typedef struct {
+    uint32_t count;             // Triggers with a measured latency
+    uint32_t missed;            // Triggers whose PUBACK did not arrive
+    uint32_t last_ms;
+    uint32_t min_ms;
+    uint32_t max_ms;
+    uint64_t total_ms;
+    uint16_t buckets[TRIGGER_LATENCY_BUCKETS];
+} trigger_latency_stats_t;
+
+// Take the app_main timestamp that ties the RTC wake time to esp_timer
+// (call right after boot_timing_record)
+void trigger_latency_capture(void);
+
+// Sensors (bit mask of sensor indexes) that woke the device this wake
+void trigger_latency_set_sensors(uint32_t sensors);
+
+// Sensors whose trigger this wake awaits its report (0 if the wake was not
+// triggered by a wake pin sensor or its wake time is unknown)
+uint32_t trigger_latency_pending(void);
+
+// Wait for the PUBACK of the tracked state publish, record the latency and
+// publish the trigger event (MQTT must be connected). Does nothing if no
+// trigger is pending.
+void trigger_latency_report(void);
+
+// Statistics since power-up
+const trigger_latency_stats_t *trigger_latency_stats(void);
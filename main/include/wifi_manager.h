@@ -7,7 +7,7 @@
 #include "esp_mac.h"
 #include "esp_netif.h"
 
-// Initialize WiFi with timeout
+// Initialize WiFi with timeout (may be called again after a failed connect)
 bool wifi_manager_init(void);
 
 // WiFi event handler
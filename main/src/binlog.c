@@ -0,0 +1,196 @@
+#include "binlog.h"
+#include "mqtt_manager.h"
+#include "device_config.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "esp_sleep.h"
+#include "esp_system.h"
+
+// Record header word: [31:30] level-1, [29:27] nargs, [26:21] tag, [11:0] format
+#define REC_HEADER(level, nargs, tag, fmt) \
+    ((((uint32_t)(level) - 1) << 30) | ((uint32_t)(nargs) << 27) | \
+     ((uint32_t)(tag) << 21) | ((uint32_t)(fmt) & 0xFFF))
+#define REC_WORDS(header) (2 + (((header) >> 27) & 0x7))
+
+// Timestamp word: [31:20] boot sequence, [19:0] milliseconds since boot
+#define REC_TIMESTAMP(seq, ms) ((((uint32_t)(seq) & 0xFFF) << 20) | ((uint32_t)(ms) & 0xFFFFF))
+
+typedef struct {
+    uint32_t magic;
+    uint16_t boot_seq;
+    uint16_t words;
+    uint32_t dropped;
+} binlog_blob_header_t;
+
+// Ring buffer state lives in RTC memory that the bootloader leaves alone, so
+// it survives deep sleep and also panic, watchdog and software resets: the
+// records leading up to a crash are still there on the next boot. After a
+// power-on it holds garbage, which ring_magic tells apart (the buffer size is
+// part of the magic, so a layout change also starts a fresh ring).
+#define RING_MAGIC (0x424C0000 | BINLOG_BUFFER_WORDS)  // "BL" + size
+
+RTC_NOINIT_ATTR static uint32_t ring_magic;
+RTC_NOINIT_ATTR static uint32_t ring[BINLOG_BUFFER_WORDS];
+RTC_NOINIT_ATTR static uint16_t ring_head;     // Next word to write
+RTC_NOINIT_ATTR static uint16_t ring_tail;     // Oldest record
+RTC_NOINIT_ATTR static uint16_t ring_used;     // Words in use
+RTC_NOINIT_ATTR static uint16_t boot_seq;
+RTC_NOINIT_ATTR static uint32_t dropped_records;
+
+static portMUX_TYPE ring_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void ring_reset(void)
+{
+    ring_head = 0;
+    ring_tail = 0;
+    ring_used = 0;
+    dropped_records = 0;
+}
+
+void FAST_BOOT_IRAM binlog_init(void)
+{
+    // Sanity check the RTC state in case it is uninitialized (power-on),
+    // corrupted or the layout changed
+    if (ring_magic != RING_MAGIC || esp_reset_reason() == ESP_RST_POWERON) {
+        ring_reset();
+        boot_seq = 0;
+        ring_magic = RING_MAGIC;
+    } else if (ring_used > BINLOG_BUFFER_WORDS || ring_head >= BINLOG_BUFFER_WORDS ||
+               ring_tail >= BINLOG_BUFFER_WORDS ||
+               (ring_tail + ring_used) % BINLOG_BUFFER_WORDS != ring_head) {
+        ring_reset();
+    }
+
+    boot_seq++;
+    BINLOG_I(BINLOG, BOOT, boot_seq, esp_reset_reason(),
+             esp_sleep_get_wakeup_cause(), USE_WAKE_CIRCUIT);
+}
+
+void FAST_BOOT_IRAM binlog_write(int level, int tag, int fmt, int nargs, ...)
+{
+    uint32_t words[2 + BINLOG_MAX_ARGS];
+    va_list args;
+
+    if (nargs > BINLOG_MAX_ARGS) nargs = BINLOG_MAX_ARGS;
+
+    words[0] = REC_HEADER(level, nargs, tag, fmt);
+    words[1] = REC_TIMESTAMP(boot_seq, esp_timer_get_time() / 1000);
+    va_start(args, nargs);
+    for (int i = 0; i < nargs; i++) {
+        words[2 + i] = (uint32_t)va_arg(args, int);
+    }
+    va_end(args);
+
+    int needed = 2 + nargs;
+
+    portENTER_CRITICAL(&ring_lock);
+    // Drop the oldest records until the new one fits
+    while (BINLOG_BUFFER_WORDS - ring_used < needed) {
+        int len = REC_WORDS(ring[ring_tail]);
+        ring_tail = (ring_tail + len) % BINLOG_BUFFER_WORDS;
+        ring_used -= len;
+        dropped_records++;
+    }
+    for (int i = 0; i < needed; i++) {
+        ring[ring_head] = words[i];
+        ring_head = (ring_head + 1) % BINLOG_BUFFER_WORDS;
+    }
+    ring_used += needed;
+    portEXIT_CRITICAL(&ring_lock);
+}
+
+size_t binlog_snapshot_size(void)
+{
+    return sizeof(binlog_blob_header_t) + ring_used * sizeof(uint32_t);
+}
+
+size_t binlog_snapshot(uint8_t *out, size_t out_len)
+{
+    binlog_blob_header_t header = {
+        .magic = BINLOG_MAGIC,
+    };
+
+    portENTER_CRITICAL(&ring_lock);
+    size_t size = sizeof(header) + ring_used * sizeof(uint32_t);
+    if (size > out_len) {
+        portEXIT_CRITICAL(&ring_lock);
+        return 0;
+    }
+
+    header.boot_seq = boot_seq;
+    header.words = ring_used;
+    header.dropped = dropped_records;
+    memcpy(out, &header, sizeof(header));
+
+    // Copy out oldest first, unwrapping the ring
+    uint32_t *dst = (uint32_t *)(out + sizeof(header));
+    uint16_t idx = ring_tail;
+    for (uint16_t i = 0; i < ring_used; i++) {
+        dst[i] = ring[idx];
+        idx = (idx + 1) % BINLOG_BUFFER_WORDS;
+    }
+    portEXIT_CRITICAL(&ring_lock);
+
+    return size;
+}
+
+void binlog_clear(void)
+{
+    portENTER_CRITICAL(&ring_lock);
+    ring_reset();
+    portEXIT_CRITICAL(&ring_lock);
+}
+
+void binlog_flush_uart(void)
+{
+    static uint8_t blob[sizeof(binlog_blob_header_t) + BINLOG_BUFFER_WORDS * sizeof(uint32_t)];
+    size_t len = binlog_snapshot(blob, sizeof(blob));
+
+    // One "BINLOG" line per 32 bytes; tools/binlog_decode.py picks these out
+    // of a captured console log
+    for (size_t i = 0; i < len; i += 32) {
+        printf("BINLOG ");
+        for (size_t j = i; j < len && j < i + 32; j++) {
+            printf("%02x", blob[j]);
+        }
+        printf("\n");
+    }
+    printf("BINLOG END\n");
+
+    binlog_clear();
+}
+
+void binlog_handle_upload_request(const char *request)
+{
+    if (!request || request[0] == '\0' || strcmp(request, "0") == 0) {
+        return;
+    }
+
+    size_t size = binlog_snapshot_size();
+    uint8_t *blob = malloc(size);
+    if (!blob) {
+        BINLOG_E(BINLOG, LOG_UPLOAD_FAILED);
+        return;
+    }
+
+    size = binlog_snapshot(blob, size);
+    BINLOG_I(BINLOG, LOG_UPLOAD, ((binlog_blob_header_t *)blob)->words, dropped_records);
+
+    // Retained, as the request may be served hours after it was made; the
+    // ring is only cleared once the broker has the log
+    if (size > 0 && mqtt_manager_publish_data_tracked(device_config_topic(DEVICE_TOPIC_LOG), blob, size, 1)) {
+        if (mqtt_manager_wait_acked(MQTT_UPLOAD_ACK_TIMEOUT_MS) >= 0) {
+            // Clear the retained request so the upload only happens once
+            mqtt_manager_publish(device_config_topic(DEVICE_TOPIC_LOG_REQUEST), "", 1, 1);
+            binlog_clear();
+        } else {
+            BINLOG_W(BINLOG, UPLOAD_NO_PUBACK, MQTT_UPLOAD_ACK_TIMEOUT_MS);
+        }
+    } else {
+        BINLOG_E(BINLOG, LOG_UPLOAD_FAILED);
+    }
+    free(blob);
+}
@@ -0,0 +1,74 @@
+#include "boot_timing.h"
+#include "binlog.h"
+#include "esp_attr.h"
+#include "esp_sleep.h"
+#include "esp_system.h"
+#include "esp_private/esp_clk.h"
+#include "soc/rtc_cntl_reg.h"
+
+RTC_DATA_ATTR static boot_timing_t timing;
+RTC_DATA_ATTR static uint64_t wake_total_us;
+
+// Set by the wake stub on each deep sleep wake
+RTC_DATA_ATTR static uint64_t wake_stub_ticks;
+
+// Wake stub timestamp of the current wake, taken over by boot_timing_record
+static uint64_t wake_ticks;
+
+// RTC slow timer, read straight from the registers so the wake stub can use it
+static inline __attribute__((always_inline)) uint64_t rtc_ticks(void)
+{
+    SET_PERI_REG_MASK(RTC_CNTL_TIME_UPDATE_REG, RTC_CNTL_TIME_UPDATE);
+    uint64_t ticks = READ_PERI_REG(RTC_CNTL_TIME0_REG);
+    ticks |= (uint64_t)READ_PERI_REG(RTC_CNTL_TIME1_REG) << 32;
+    return ticks;
+}
+
+// Runs from RTC fast memory right after the ROM on every deep sleep wake,
+// before the bootloader; only RTC memory and registers can be used here
+void RTC_IRAM_ATTR esp_wake_deep_sleep(void)
+{
+    wake_stub_ticks = rtc_ticks();
+    esp_default_wake_deep_sleep();
+}
+
+static uint32_t ticks_to_us(uint64_t ticks)
+{
+    // Calibration value: microseconds per slow clock tick, Q13.19
+    return (uint32_t)((ticks * esp_clk_slowclk_cal_get()) >> 19);
+}
+
+void FAST_BOOT_IRAM boot_timing_record(void)
+{
+    uint64_t now = rtc_ticks();
+
+    timing.last_us = 0;
+    if (esp_reset_reason() == ESP_RST_DEEPSLEEP) {
+        if (wake_stub_ticks == 0 || wake_stub_ticks > now) {
+            return;
+        }
+        timing.last_us = ticks_to_us(now - wake_stub_ticks);
+        wake_ticks = wake_stub_ticks;
+        wake_stub_ticks = 0;
+        timing.wakes++;
+        wake_total_us += timing.last_us;
+        timing.wake_avg_us = wake_total_us / timing.wakes;
+        if (timing.last_us > timing.wake_max_us) {
+            timing.wake_max_us = timing.last_us;
+        }
+        BINLOG_D(MAIN, BOOT_TIME, timing.last_us, 1);
+    } else if (esp_reset_reason() == ESP_RST_POWERON) {
+        timing.cold_us = ticks_to_us(now);
+        BINLOG_I(MAIN, BOOT_TIME, timing.cold_us, 0);
+    }
+}
+
+const boot_timing_t *boot_timing_get(void)
+{
+    return &timing;
+}
+
+uint64_t boot_timing_wake_us(void)
+{
+    return (wake_ticks * esp_clk_slowclk_cal_get()) >> 19;
+}
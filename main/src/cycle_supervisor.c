@@ -0,0 +1,233 @@
+#include "cycle_supervisor.h"
+#include "binlog.h"
+#include "mem_stats.h"
+#include "sensor_manager.h"
+#include "power_governor.h"
+#include <stdio.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "esp_sleep.h"
+#include "esp_system.h"
+#include "esp_wifi.h"
+#include "driver/gpio.h"
+
+// Kept in RTC memory that the bootloader does not initialize, so the stats
+// and the phase a reset hit survive panic, watchdog and brownout resets
+// (RTC_DATA_ATTR variables are reloaded on every boot except a deep sleep wake).
+// The magic word tells them from the garbage left after a power-on.
+#define CYCLE_STATS_MAGIC 0x43594331  // "CYC1", change when cycle_stats_t changes
+
+RTC_NOINIT_ATTR static uint32_t stats_magic;
+RTC_NOINIT_ATTR static cycle_stats_t stats;
+RTC_NOINIT_ATTR static uint8_t current_phase;
+
+static esp_timer_handle_t budget_timer = NULL;
+static volatile bool budget_expired = false;
+static int64_t deadline_us = 0;
+static uint32_t budget_ms = 0;
+
+static portMUX_TYPE sleep_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool sleep_started = false;
+
+static const char *phase_names[] = {
+    [CYCLE_PHASE_BOOT] = "boot",
+    [CYCLE_PHASE_SAMPLING] = "sampling",
+    [CYCLE_PHASE_WIFI] = "wifi",
+    [CYCLE_PHASE_MQTT] = "mqtt",
+    [CYCLE_PHASE_PUBLISH] = "publish",
+    [CYCLE_PHASE_SLEEP] = "sleep",
+    [CYCLE_PHASE_OTA] = "ota",
+};
+
+static void record_event(cycle_abort_t reason, uint8_t phase, int32_t detail)
+{
+    stats.last_abort = reason;
+    stats.last_phase = phase;
+    stats.last_detail = detail;
+}
+
+static void __attribute__((noreturn)) enter_deep_sleep(void)
+{
+    // Only the first caller (main task or budget timer) goes on to sleep
+    portENTER_CRITICAL(&sleep_lock);
+    bool already_started = sleep_started;
+    sleep_started = true;
+    portEXIT_CRITICAL(&sleep_lock);
+    if (already_started) {
+        while (1) {
+            vTaskDelay(portMAX_DELAY);
+        }
+    }
+
+    current_phase = CYCLE_PHASE_SLEEP;
+    if (budget_timer) {
+        esp_timer_stop(budget_timer);
+    }
+
+    uint32_t awake_ms = esp_timer_get_time() / 1000;
+    stats.last_awake_ms = awake_ms;
+    if (awake_ms > stats.max_awake_ms) {
+        stats.max_awake_ms = awake_ms;
+    }
+
+    // Record how close this cycle came to the heap and stack limits
+    mem_stats_sample();
+
+    // Wi-Fi must be stopped before deep sleep; harmless if it never started
+    esp_wifi_stop();
+
+    // Wake pin sensors (wake circuit comparators) wake the device when they go HIGH.
+    // ESP32-C3 doesn't support ext0 wakeup, use gpio wakeup instead; the pins
+    // were configured as pulled-down inputs by sensor_manager_init
+    uint64_t wake_pins = sensor_manager_wake_pin_mask();
+    if (wake_pins) {
+        uint32_t levels = 0;
+        for (int pin = 0; pin < 32; pin++) {
+            if ((wake_pins & BIT64(pin)) && gpio_get_level(pin)) {
+                levels |= BIT(pin);
+            }
+        }
+        BINLOG_D(MAIN, SLEEP_WAKE_PINS, (uint32_t)wake_pins, levels);
+        esp_deep_sleep_enable_gpio_wakeup(wake_pins, ESP_GPIO_WAKEUP_GPIO_HIGH);
+    }
+
+    #if USE_WAKE_CIRCUIT
+    // Wake for heartbeat, less often as the supply runs down
+    int heartbeat_scale = power_governor_heartbeat_scale();
+    esp_sleep_enable_timer_wakeup(WAKE_CIRCUIT_SLEEP_TIME_SECONDS * heartbeat_scale * 1000000ULL);
+    BINLOG_I(MAIN, SLEEP_HOURS, HEARTBEAT_INTERVAL_HOURS * heartbeat_scale);
+    #else
+    esp_sleep_enable_timer_wakeup(SLEEP_TIME_SECONDS * 1000000ULL);
+    BINLOG_D(MAIN, SLEEP_SECONDS, SLEEP_TIME_SECONDS);
+    #endif
+
+    esp_deep_sleep_start();
+}
+
+// Runs in the esp_timer task: first at the budget, then after the grace period
+static void budget_timer_cb(void *arg)
+{
+    if (!budget_expired) {
+        budget_expired = true;
+        stats.overruns++;
+        record_event(CYCLE_ABORT_BUDGET, current_phase, budget_ms);
+        BINLOG_W(SUPERVISOR, CYCLE_OVERRUN, budget_ms, current_phase);
+        esp_timer_start_once(budget_timer, CYCLE_BUDGET_GRACE_MS * 1000ULL);
+    } else {
+        BINLOG_E(SUPERVISOR, CYCLE_FORCED_SLEEP, current_phase);
+        enter_deep_sleep();
+    }
+}
+
+void cycle_supervisor_start(void)
+{
+    esp_reset_reason_t reset_reason = esp_reset_reason();
+    if (reset_reason == ESP_RST_POWERON || stats_magic != CYCLE_STATS_MAGIC) {
+        memset(&stats, 0, sizeof(stats));
+        current_phase = CYCLE_PHASE_BOOT;
+        stats_magic = CYCLE_STATS_MAGIC;
+    }
+
+    stats.cycles++;
+
+    // A crash or watchdog reset would otherwise go unnoticed
+    if (reset_reason == ESP_RST_PANIC || reset_reason == ESP_RST_INT_WDT ||
+        reset_reason == ESP_RST_TASK_WDT || reset_reason == ESP_RST_WDT ||
+        reset_reason == ESP_RST_BROWNOUT) {
+        stats.resets++;
+        record_event(CYCLE_ABORT_RESET, current_phase, reset_reason);
+        BINLOG_W(SUPERVISOR, CYCLE_RESET, reset_reason, current_phase);
+    }
+    current_phase = CYCLE_PHASE_BOOT;
+
+    switch (esp_sleep_get_wakeup_cause()) {
+        case ESP_SLEEP_WAKEUP_TIMER:
+            budget_ms = CYCLE_BUDGET_TIMER_MS;
+            break;
+        case ESP_SLEEP_WAKEUP_GPIO:
+        case ESP_SLEEP_WAKEUP_EXT0:
+            budget_ms = CYCLE_BUDGET_WAKE_PIN_MS;
+            break;
+        default:
+            budget_ms = CYCLE_BUDGET_FIRST_BOOT_MS;
+            break;
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = budget_timer_cb,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "cycle_budget",
+    };
+    CYCLE_CHECK(esp_timer_create(&timer_args, &budget_timer));
+    deadline_us = esp_timer_get_time() + budget_ms * 1000LL;
+    CYCLE_CHECK(esp_timer_start_once(budget_timer, budget_ms * 1000ULL));
+}
+
+void cycle_supervisor_cancel(void)
+{
+    if (budget_timer) {
+        esp_timer_stop(budget_timer);
+    }
+    budget_expired = false;
+}
+
+void cycle_supervisor_set_phase(cycle_phase_t phase)
+{
+    current_phase = phase;
+}
+
+void cycle_supervisor_extend(uint32_t extra_ms)
+{
+    if (!budget_timer || budget_expired) {
+        return;
+    }
+    esp_timer_stop(budget_timer);
+    if (budget_expired) {
+        // The timer fired in between; let the wind-down run its course
+        esp_timer_start_once(budget_timer, CYCLE_BUDGET_GRACE_MS * 1000ULL);
+        return;
+    }
+    budget_ms += extra_ms;
+    deadline_us += extra_ms * 1000LL;
+    int64_t remaining_us = deadline_us - esp_timer_get_time();
+    esp_timer_start_once(budget_timer, remaining_us > 0 ? remaining_us : 1);
+}
+
+bool cycle_supervisor_expired(void)
+{
+    return budget_expired;
+}
+
+int cycle_supervisor_remaining_ms(void)
+{
+    int64_t remaining_us = deadline_us - esp_timer_get_time();
+    return (budget_expired || remaining_us <= 0) ? 0 : (int)(remaining_us / 1000);
+}
+
+void cycle_supervisor_abort(cycle_abort_t reason, int32_t detail)
+{
+    if (reason == CYCLE_ABORT_ERROR) {
+        stats.errors++;
+    }
+    record_event(reason, current_phase, detail);
+    BINLOG_E(SUPERVISOR, CYCLE_ABORT, reason, detail, current_phase);
+    enter_deep_sleep();
+}
+
+void cycle_supervisor_sleep(void)
+{
+    enter_deep_sleep();
+}
+
+const cycle_stats_t *cycle_supervisor_stats(void)
+{
+    return &stats;
+}
+
+const char *cycle_supervisor_phase_name(cycle_phase_t phase)
+{
+    if (phase >= sizeof(phase_names) / sizeof(phase_names[0])) {
+        return "unknown";
+    }
+    return phase_names[phase];
+}
@@ -0,0 +1,149 @@
+#include "delta_patch.h"
+#include <string.h>
+
+enum {
+    STATE_OP,
+    STATE_COPY_OFFSET,
+    STATE_COPY_LENGTH,
+    STATE_INSERT_LENGTH,
+    STATE_INSERT_DATA,
+    STATE_END,
+};
+
+void delta_patch_init(delta_patch_t *patch, uint32_t source_size, uint32_t target_size,
+                      delta_read_fn read, delta_write_fn write, void *ctx)
+{
+    memset(patch, 0, sizeof(*patch));
+    patch->read = read;
+    patch->write = write;
+    patch->ctx = ctx;
+    patch->source_size = source_size;
+    patch->target_size = target_size;
+    patch->state = STATE_OP;
+}
+
+int delta_header_check(const delta_header_t *header)
+{
+    if (memcmp(header->magic, DELTA_MAGIC, 4) != 0 || header->version != DELTA_VERSION) {
+        return -1;
+    }
+    return 0;
+}
+
+// Fold one byte into the varint being parsed; sets *complete on its last byte
+static int varint_add(delta_patch_t *patch, uint8_t byte, int *complete)
+{
+    if (patch->varint_shift > 28) {
+        return DELTA_ERR_OP;
+    }
+    patch->varint |= (uint32_t)(byte & 0x7F) << patch->varint_shift;
+    patch->varint_shift += 7;
+    *complete = !(byte & 0x80);
+    return DELTA_OK;
+}
+
+static void varint_reset(delta_patch_t *patch)
+{
+    patch->varint = 0;
+    patch->varint_shift = 0;
+}
+
+static int emit(delta_patch_t *patch, const uint8_t *data, size_t len)
+{
+    if (len > patch->target_size - patch->written) {
+        return DELTA_ERR_RANGE;
+    }
+    if (patch->write(patch->ctx, data, len) != 0) {
+        return DELTA_ERR_WRITE;
+    }
+    patch->written += len;
+    return DELTA_OK;
+}
+
+static int copy_source(delta_patch_t *patch, uint32_t offset, uint32_t len)
+{
+    if (offset > patch->source_size || len > patch->source_size - offset) {
+        return DELTA_ERR_RANGE;
+    }
+    while (len > 0) {
+        size_t chunk = len < sizeof(patch->copy_buf) ? len : sizeof(patch->copy_buf);
+        if (patch->read(patch->ctx, offset, patch->copy_buf, chunk) != 0) {
+            return DELTA_ERR_READ;
+        }
+        int rc = emit(patch, patch->copy_buf, chunk);
+        if (rc != DELTA_OK) {
+            return rc;
+        }
+        offset += chunk;
+        len -= chunk;
+    }
+    return DELTA_OK;
+}
+
+int delta_patch_feed(delta_patch_t *patch, const uint8_t *data, size_t len)
+{
+    size_t pos = 0;
+    int complete = 0;
+    int rc = DELTA_OK;
+
+    if (patch->result != DELTA_OK) {
+        // Anything after END is an error; errors are sticky
+        return (patch->result == DELTA_DONE && len > 0) ? DELTA_ERR_OP : patch->result;
+    }
+
+    while (pos < len && rc == DELTA_OK) {
+        switch (patch->state) {
+            case STATE_OP:
+                varint_reset(patch);
+                switch (data[pos++]) {
+                    case DELTA_OP_COPY: patch->state = STATE_COPY_OFFSET; break;
+                    case DELTA_OP_INSERT: patch->state = STATE_INSERT_LENGTH; break;
+                    case DELTA_OP_END: patch->state = STATE_END; break;
+                    default: rc = DELTA_ERR_OP; break;
+                }
+                break;
+            case STATE_COPY_OFFSET:
+                rc = varint_add(patch, data[pos++], &complete);
+                if (rc == DELTA_OK && complete) {
+                    patch->copy_offset = patch->varint;
+                    varint_reset(patch);
+                    patch->state = STATE_COPY_LENGTH;
+                }
+                break;
+            case STATE_COPY_LENGTH:
+                rc = varint_add(patch, data[pos++], &complete);
+                if (rc == DELTA_OK && complete) {
+                    rc = copy_source(patch, patch->copy_offset, patch->varint);
+                    patch->state = STATE_OP;
+                }
+                break;
+            case STATE_INSERT_LENGTH:
+                rc = varint_add(patch, data[pos++], &complete);
+                if (rc == DELTA_OK && complete) {
+                    patch->remaining = patch->varint;
+                    patch->state = patch->remaining ? STATE_INSERT_DATA : STATE_OP;
+                }
+                break;
+            case STATE_INSERT_DATA: {
+                size_t chunk = len - pos;
+                if (chunk > patch->remaining) chunk = patch->remaining;
+                rc = emit(patch, data + pos, chunk);
+                pos += chunk;
+                patch->remaining -= chunk;
+                if (patch->remaining == 0) {
+                    patch->state = STATE_OP;
+                }
+                break;
+            }
+            case STATE_END:
+                rc = DELTA_ERR_OP;
+                break;
+        }
+    }
+
+    if (rc == DELTA_OK && patch->state == STATE_END) {
+        rc = DELTA_DONE;
+    }
+    patch->result = rc;
+    return rc;
+}
@@ -0,0 +1,368 @@
+#include "device_config.h"
+#include "binlog.h"
+#include "sensor_manager.h"
+#include "telemetry.h"
+#include "ota_manager.h"
+#include "trigger_latency.h"
+#include "nvs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "device_config";
+
+// Longest suffix appended to the topic prefix ("/trace/request")
+#define TOPIC_SUFFIX_MAX 16
+
+static const char *const default_topics[DEVICE_TOPIC_COUNT] = {
+    [DEVICE_TOPIC_AVAILABILITY] = MQTT_TOPIC_AVAILABILITY,
+    [DEVICE_TOPIC_TELEMETRY] = MQTT_TOPIC_TELEMETRY,
+    [DEVICE_TOPIC_LOG] = MQTT_TOPIC_LOG,
+    [DEVICE_TOPIC_LOG_REQUEST] = MQTT_TOPIC_LOG_REQUEST,
+    [DEVICE_TOPIC_TRACE] = MQTT_TOPIC_TRACE,
+    [DEVICE_TOPIC_TRACE_REQUEST] = MQTT_TOPIC_TRACE_REQUEST,
+    [DEVICE_TOPIC_OTA] = MQTT_TOPIC_OTA,
+    [DEVICE_TOPIC_OTA_DELTA] = MQTT_TOPIC_OTA_DELTA,
+    [DEVICE_TOPIC_OTA_STATUS] = MQTT_TOPIC_OTA_STATUS,
+    [DEVICE_TOPIC_TRIGGER] = MQTT_TOPIC_TRIGGER,
+};
+
+// Settings in use; the defaults apply until device_config_load finds more
+static int settings_loaded = 0;
+static char trap_id[DEVICE_ID_MAX] = TRAP_ID;
+static char prefix[DEVICE_TOPIC_MAX] = MQTT_TOPIC_PREFIX;
+static bool prefix_provisioned = false;
+static char topics[DEVICE_TOPIC_COUNT][DEVICE_TOPIC_MAX];
+static const char *topic_in_use[DEVICE_TOPIC_COUNT];
+static char sensor_topics[SENSOR_MAX_CHANNELS][DEVICE_TOPIC_MAX];
+static uint32_t sensor_topic_mask = 0;
+static int sensor_thresholds[SENSOR_MAX_CHANNELS];
+static uint32_t sensor_threshold_mask = 0;
+
+// Provisioned settings as read from NVS, cached in RTC memory so deep sleep
+// wakes do not need NVS: "key\0value\0" pairs (thresholds in decimal). The
+// cache is cleared by every boot other than a deep sleep wake, including the
+// restart after provisioning. If the settings do not fit, NVS is read on
+// every wake instead.
+RTC_DATA_ATTR static bool cache_valid = false;
+RTC_DATA_ATTR static uint16_t cache_used = 0;
+RTC_DATA_ATTR static char cache[DEVICE_CONFIG_CACHE_SIZE];
+
+// Settings source for device_config_load: NVS (filling the cache) or the cache
+static nvs_handle_t load_handle = 0;
+static bool load_from_nvs = false;
+static bool cache_overflow = false;
+
+// Settings staged during provisioning, written together on commit
+#define STAGED_MAX (3 + 2 * SENSOR_MAX_CHANNELS)
+
+typedef struct {
+    char key[8];
+    char value[DEVICE_TOPIC_MAX];
+} staged_setting_t;
+
+static staged_setting_t *staged = NULL;  // Allocated by the first device_config_set
+static int staged_count = 0;
+static bool staged_erase = false;
+
+// Move a topic under the build's prefix to the provisioned one. Topics
+// outside the prefix (custom overrides in config.h) are kept as they are.
+static const char *rewrite_topic(char *out, const char *topic)
+{
+    size_t n = strlen(MQTT_TOPIC_PREFIX);
+    if (!prefix_provisioned || strncmp(topic, MQTT_TOPIC_PREFIX, n) != 0 ||
+        (topic[n] != '/' && topic[n] != '\0')) {
+        return topic;
+    }
+
+    int len = snprintf(out, DEVICE_TOPIC_MAX, "%s%s", prefix, topic + n);
+    return (len > 0 && len < DEVICE_TOPIC_MAX) ? out : topic;
+}
+
+// Sensor table index from a "thrN" / "topicN" key suffix, or -1
+static int parse_index(const char *digits)
+{
+    if (digits[0] < '0' || digits[0] > '9' || digits[1] != '\0') {
+        return -1;
+    }
+    int index = digits[0] - '0';
+    return index < sensor_manager_count() ? index : -1;
+}
+
+// MQTT topic (or topic level) without wildcards or control characters
+static bool valid_topic(const char *value, size_t max_len, bool single_level)
+{
+    size_t len = strlen(value);
+    if (len == 0 || len >= max_len) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        char c = value[i];
+        if (c < 0x20 || c == 0x7f || c == '+' || c == '#' || (single_level && c == '/')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void cache_add(const char *key, const char *value)
+{
+    size_t key_len = strlen(key) + 1;
+    size_t value_len = strlen(value) + 1;
+    if (cache_used + key_len + value_len > sizeof(cache)) {
+        cache_overflow = true;
+        return;
+    }
+    memcpy(cache + cache_used, key, key_len);
+    memcpy(cache + cache_used + key_len, value, value_len);
+    cache_used += key_len + value_len;
+}
+
+static bool cache_find(const char *key, char *value, size_t size)
+{
+    for (size_t pos = 0; pos < cache_used; ) {
+        const char *entry_key = cache + pos;
+        const char *entry_value = entry_key + strlen(entry_key) + 1;
+        if (strcmp(entry_key, key) == 0) {
+            return snprintf(value, size, "%s", entry_value) < (int)size;
+        }
+        pos = entry_value + strlen(entry_value) + 1 - cache;
+    }
+    return false;
+}
+
+// Read one string setting from the current source
+static bool get_setting(const char *key, char *value, size_t size)
+{
+    if (!load_from_nvs) {
+        return cache_find(key, value, size);
+    }
+    size_t len = size;
+    if (nvs_get_str(load_handle, key, value, &len) != ESP_OK) {
+        return false;
+    }
+    cache_add(key, value);
+    return true;
+}
+
+// Read one threshold setting (u16 in NVS) from the current source
+static bool get_threshold(const char *key, int *threshold)
+{
+    char value[8];
+    if (!load_from_nvs) {
+        if (!cache_find(key, value, sizeof(value))) {
+            return false;
+        }
+        *threshold = atoi(value);
+        return true;
+    }
+    uint16_t stored;
+    if (nvs_get_u16(load_handle, key, &stored) != ESP_OK) {
+        return false;
+    }
+    snprintf(value, sizeof(value), "%u", stored);
+    cache_add(key, value);
+    *threshold = stored;
+    return true;
+}
+
+bool device_config_cached(void)
+{
+    return cache_valid;
+}
+
+esp_err_t device_config_load(void)
+{
+    load_from_nvs = !cache_valid;
+    if (load_from_nvs) {
+        cache_used = 0;
+        cache_overflow = false;
+        esp_err_t ret = nvs_open(DEVICE_CONFIG_NAMESPACE, NVS_READONLY, &load_handle);
+        if (ret == ESP_ERR_NVS_NOT_FOUND) {
+            cache_valid = true;
+            return ESP_OK;  // Never provisioned: build defaults
+        }
+        if (ret != ESP_OK) {
+            BINLOG_W(CONFIG, CONFIG_LOAD_FAILED, ret);
+            return ret;
+        }
+    }
+
+    if (get_setting("id", trap_id, sizeof(trap_id))) {
+        snprintf(prefix, sizeof(prefix), MQTT_TOPIC_BASE "%s", trap_id);
+        prefix_provisioned = true;
+        settings_loaded++;
+    }
+    if (get_setting("prefix", prefix, sizeof(prefix))) {
+        prefix_provisioned = true;
+        settings_loaded++;
+    }
+
+    for (int t = 0; t < DEVICE_TOPIC_COUNT; t++) {
+        if (t == DEVICE_TOPIC_AVAILABILITY &&
+            get_setting("avail", topics[t], sizeof(topics[t]))) {
+            topic_in_use[t] = topics[t];
+            settings_loaded++;
+        } else {
+            topic_in_use[t] = rewrite_topic(topics[t], default_topics[t]);
+        }
+    }
+
+    for (int i = 0; i < sensor_manager_count(); i++) {
+        char key[16];
+
+        snprintf(key, sizeof(key), "thr%d", i);
+        if (get_threshold(key, &sensor_thresholds[i])) {
+            sensor_threshold_mask |= BIT(i);
+            settings_loaded++;
+        }
+
+        snprintf(key, sizeof(key), "topic%d", i);
+        if (get_setting(key, sensor_topics[i], sizeof(sensor_topics[i]))) {
+            sensor_topic_mask |= BIT(i);
+            settings_loaded++;
+        }
+    }
+
+    if (load_from_nvs) {
+        nvs_close(load_handle);
+        cache_valid = !cache_overflow;
+        BINLOG_D(CONFIG, CONFIG_LOADED, settings_loaded);
+    }
+    return ESP_OK;
+}
+
+bool device_config_provisioned(void)
+{
+    return settings_loaded > 0;
+}
+
+const char *device_config_trap_id(void)
+{
+    return trap_id;
+}
+
+const char *device_config_topic(device_topic_t topic)
+{
+    if (topic < 0 || topic >= DEVICE_TOPIC_COUNT) {
+        return "";
+    }
+    return topic_in_use[topic] ? topic_in_use[topic] : default_topics[topic];
+}
+
+int device_config_sensor_threshold(int index, int default_threshold)
+{
+    if (index >= 0 && index < SENSOR_MAX_CHANNELS && (sensor_threshold_mask & BIT(index))) {
+        return sensor_thresholds[index];
+    }
+    return default_threshold;
+}
+
+const char *device_config_sensor_topic(int index, const char *default_topic)
+{
+    if (index < 0 || index >= SENSOR_MAX_CHANNELS) {
+        return default_topic;
+    }
+    if (sensor_topic_mask & BIT(index)) {
+        return sensor_topics[index];
+    }
+    return rewrite_topic(sensor_topics[index], default_topic);
+}
+
+// Validate a key/value pair; thresholds are checked against the ADC range
+static bool valid_setting(const char *key, const char *value)
+{
+    if (strcmp(key, "id") == 0) {
+        return valid_topic(value, DEVICE_ID_MAX, true);
+    }
+    if (strcmp(key, "prefix") == 0) {
+        return valid_topic(value, DEVICE_TOPIC_MAX - TOPIC_SUFFIX_MAX, false) &&
+               value[strlen(value) - 1] != '/';
+    }
+    if (strcmp(key, "avail") == 0 ||
+        (strncmp(key, "topic", 5) == 0 && parse_index(key + 5) >= 0)) {
+        return valid_topic(value, DEVICE_TOPIC_MAX, false);
+    }
+    if (strncmp(key, "thr", 3) == 0 && parse_index(key + 3) >= 0) {
+        char *end;
+        long threshold = strtol(value, &end, 10);
+        return *value != '\0' && *end == '\0' && threshold >= 0 && threshold <= SENSOR_ADC_MAX;
+    }
+    return false;
+}
+
+esp_err_t device_config_set(const char *key, const char *value)
+{
+    if (!valid_setting(key, value)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!staged) {
+        staged = calloc(STAGED_MAX, sizeof(staged_setting_t));
+        if (!staged) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    // A repeated key replaces the staged value
+    int slot = 0;
+    while (slot < staged_count && strcmp(staged[slot].key, key) != 0) {
+        slot++;
+    }
+    if (slot == STAGED_MAX) {
+        return ESP_ERR_NO_MEM;
+    }
+    snprintf(staged[slot].key, sizeof(staged[slot].key), "%s", key);
+    snprintf(staged[slot].value, sizeof(staged[slot].value), "%s", value);
+    if (slot == staged_count) {
+        staged_count++;
+    }
+    return ESP_OK;
+}
+
+esp_err_t device_config_erase(void)
+{
+    staged_erase = true;
+    staged_count = 0;
+    return ESP_OK;
+}
+
+void device_config_discard(void)
+{
+    free(staged);
+    staged = NULL;
+    staged_count = 0;
+    staged_erase = false;
+}
+
+esp_err_t device_config_commit(void)
+{
+    nvs_handle_t handle;
+    esp_err_t ret = nvs_open(DEVICE_CONFIG_NAMESPACE, NVS_READWRITE, &handle);
+    if (ret != ESP_OK) {
+        device_config_discard();
+        return ret;
+    }
+
+    if (staged_erase) {
+        ret = nvs_erase_all(handle);
+    }
+    for (int i = 0; i < staged_count && ret == ESP_OK; i++) {
+        if (strncmp(staged[i].key, "thr", 3) == 0) {
+            ret = nvs_set_u16(handle, staged[i].key, (uint16_t)atoi(staged[i].value));
+        } else {
+            ret = nvs_set_str(handle, staged[i].key, staged[i].value);
+        }
+    }
+    if (ret == ESP_OK) {
+        ret = nvs_commit(handle);
+    }
+    nvs_close(handle);
+
+    if (ret == ESP_OK) {
+        BINLOG_I(CONFIG, CONFIG_COMMITTED, staged_count);
+    } else {
+        printf("[%s] Failed to write device config, err=%d\n", TAG, ret);
+    }
+    device_config_discard();
+    return ret;
+}
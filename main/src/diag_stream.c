@@ -0,0 +1,164 @@
+#include "diag_stream.h"
+#include "sensor_manager.h"
+#include "esp_timer.h"
+#include <stdio.h>
+#include <string.h>
+
+// One channel per sensor table entry; in wake circuit mode the raw LDR1
+// reading is appended so the comparator can be calibrated against it
+#if USE_WAKE_CIRCUIT
+    #define STREAM_MAX_CHANNELS (SENSOR_MAX_CHANNELS + 1)
+#else
+    #define STREAM_MAX_CHANNELS SENSOR_MAX_CHANNELS
+#endif
+#define STREAM_BUFFERS 2
+
+static const char *TAG = "diag_stream";
+
+// Double buffer filled by the sampling timer and drained by the calling task
+typedef struct {
+    uint16_t samples[STREAM_PACKET_COUNT * STREAM_MAX_CHANNELS];
+    uint32_t t0_us;
+    volatile bool ready;
+} stream_buffer_t;
+
+static stream_buffer_t buffers[STREAM_BUFFERS];
+static int fill_buffer = 0;
+static int fill_count = 0;
+static volatile bool samples_dropped = false;
+static int stream_channels = 0;
+static adc_oneshot_unit_handle_t stream_adc = NULL;
+static TaskHandle_t stream_task = NULL;
+
+esp_err_t diag_stream_init(void)
+{
+    if (uart_is_driver_installed(STREAM_UART)) {
+        return ESP_OK;
+    }
+    // TX buffer lets packet writes return while the FIFO drains
+    return uart_driver_install(STREAM_UART, 256, 4096, 0, NULL, 0);
+}
+
+// Runs in the esp_timer task at STREAM_SAMPLE_RATE_HZ
+static void stream_sample_cb(void *arg)
+{
+    stream_buffer_t *buf = &buffers[fill_buffer];
+    uint16_t *frame = &buf->samples[fill_count * stream_channels];
+    int sensors = sensor_manager_count();
+
+    if (buf->ready) {
+        // Writer fell behind and the buffer has not been sent yet
+        samples_dropped = true;
+        return;
+    }
+
+    if (fill_count == 0) {
+        buf->t0_us = (uint32_t)esp_timer_get_time();
+    }
+
+    // Wake pin sensors read their own GPIO; flag its level on their channel
+    for (int i = 0; i < sensors; i++) {
+        int reading = sensor_manager_read(stream_adc, i);
+        frame[i] = reading & TRACE_SAMPLE_VALUE_MASK;
+        if (sensor_manager_get(i)->source == SENSOR_SOURCE_WAKE_PIN && reading) {
+            frame[i] |= TRACE_SAMPLE_WAKE_PIN;
+        }
+    }
+
+    #if USE_WAKE_CIRCUIT
+    int ldr1 = 0;
+    adc_oneshot_read(stream_adc, LDR1_ADC_CHANNEL, &ldr1);
+    frame[sensors] = ldr1 & TRACE_SAMPLE_VALUE_MASK;
+    #endif
+
+    if (++fill_count == STREAM_PACKET_COUNT) {
+        buf->ready = true;
+        fill_buffer = (fill_buffer + 1) % STREAM_BUFFERS;
+        fill_count = 0;
+        xTaskNotifyGive(stream_task);
+    }
+}
+
+static void stream_send_packet(stream_buffer_t *buf, uint16_t seq)
+{
+    static uint8_t packet[sizeof(stream_packet_header_t) +
+                          sizeof(buffers[0].samples) + sizeof(uint16_t)];
+    size_t samples_len = STREAM_PACKET_COUNT * stream_channels * sizeof(uint16_t);
+
+    stream_packet_header_t header = {
+        .sync = { STREAM_SYNC0, STREAM_SYNC1 },
+        .type = STREAM_PACKET_SAMPLES,
+        .channels = stream_channels,
+        .count = STREAM_PACKET_COUNT,
+        .flags = 0,
+        .seq = seq,
+        .t0_us = buf->t0_us,
+        .period_us = 1000000 / STREAM_SAMPLE_RATE_HZ,
+    };
+    if (samples_dropped) {
+        header.flags |= STREAM_FLAG_DROPPED;
+        samples_dropped = false;
+    }
+
+    size_t len = 0;
+    memcpy(packet, &header, sizeof(header));
+    len += sizeof(header);
+    memcpy(packet + len, buf->samples, samples_len);
+    len += samples_len;
+
+    uint16_t crc = trace_crc16(0xFFFF, packet + 2, len - 2);
+    packet[len++] = crc & 0xFF;
+    packet[len++] = crc >> 8;
+
+    uart_write_bytes(STREAM_UART, packet, len);
+    buf->ready = false;
+}
+
+void diag_stream_run(adc_oneshot_unit_handle_t adc1_handle)
+{
+    printf("[%s] Streaming at %d Hz, send '%c' to stop\n",
+           TAG, STREAM_SAMPLE_RATE_HZ, STREAM_CMD_STOP);
+    uart_wait_tx_done(STREAM_UART, pdMS_TO_TICKS(100));
+
+    memset(buffers, 0, sizeof(buffers));
+    fill_buffer = 0;
+    fill_count = 0;
+    samples_dropped = false;
+    stream_channels = sensor_manager_count() + (USE_WAKE_CIRCUIT ? 1 : 0);
+    stream_adc = adc1_handle;
+    stream_task = xTaskGetCurrentTaskHandle();
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = stream_sample_cb,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "diag_stream",
+    };
+    esp_timer_handle_t timer;
+    if (esp_timer_create(&timer_args, &timer) != ESP_OK) {
+        printf("[%s] Failed to create sampling timer\n", TAG);
+        return;
+    }
+    esp_timer_start_periodic(timer, 1000000 / STREAM_SAMPLE_RATE_HZ);
+
+    uint16_t seq = 0;
+    int next_buffer = 0;
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+
+        // Send completed buffers in order
+        while (buffers[next_buffer].ready) {
+            stream_send_packet(&buffers[next_buffer], seq++);
+            next_buffer = (next_buffer + 1) % STREAM_BUFFERS;
+        }
+
+        uint8_t cmd;
+        if (uart_read_bytes(STREAM_UART, &cmd, 1, 0) == 1 && cmd == STREAM_CMD_STOP) {
+            break;
+        }
+    }
+
+    esp_timer_stop(timer);
+    esp_timer_delete(timer);
+    uart_wait_tx_done(STREAM_UART, pdMS_TO_TICKS(500));
+    printf("\n[%s] Streaming stopped after %u packets\n", TAG, seq);
+}
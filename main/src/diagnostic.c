@@ -1,7 +1,13 @@
 #include "diagnostic.h"
 #include "led_controller.h"
+#include "diag_stream.h"
+#include "binlog.h"
+#include "sensor_manager.h"
+#include "device_config.h"
 #include "config.h"
 #include <stdio.h>
+#include <string.h>
+#include "esp_system.h"
 
 #define BUTTON_GPIO 3  // Built-in button
 
@@ -35,6 +41,9 @@ bool diagnostic_mode_check_entry(void)
     printf("Waiting: ");
     fflush(stdout);
     
+    // Listen for the provisioning command as well as the button
+    diag_stream_init();
+
     int check_count = 0;
     while (check_count < 30) { // 30 * 100ms = 3 seconds
         // Print countdown every second
@@ -55,8 +64,20 @@ bool diagnostic_mode_check_entry(void)
             vTaskDelay(pdMS_TO_TICKS(100)); // Debounce delay
             return true;
         }
+
+        // Wait 100ms between checks, or less if the provisioning tool asks
+        // for diagnostic mode (it repeats the command until provisioning starts)
+        uint8_t cmd;
+        int len = uart_read_bytes(STREAM_UART, &cmd, 1, pdMS_TO_TICKS(100));
+        if (len < 0) {
+            vTaskDelay(pdMS_TO_TICKS(100)); // No UART driver
+        } else if (len == 1 && cmd == DIAG_CMD_PROVISION) {
+            led_controller_set_state(true);
+            printf("\nProvisioning requested! Entering diagnostic mode\n");
+            printf("======================\n\n");
+            return true;
+        }
         
-        vTaskDelay(pdMS_TO_TICKS(100)); // Wait 100ms between checks
         check_count++;
     }
     
@@ -68,60 +89,155 @@ bool diagnostic_mode_check_entry(void)
     return false;
 }
 
+// Read one line from the host (CR ignored). Returns false on timeout; a
+// line too long for the buffer comes back empty with *overflow set.
+static bool read_line(char *line, size_t size, bool *overflow)
+{
+    size_t len = 0;
+    *overflow = false;
+    while (1) {
+        uint8_t c;
+        if (uart_read_bytes(STREAM_UART, &c, 1, pdMS_TO_TICKS(PROVISION_LINE_TIMEOUT_MS)) != 1) {
+            return false;
+        }
+        if (c == '\n') {
+            line[*overflow ? 0 : len] = '\0';
+            return true;
+        }
+        if (c == '\r') {
+            continue;
+        }
+        if (len < size - 1) {
+            line[len++] = c;
+        } else {
+            *overflow = true;
+        }
+    }
+}
+
+// Line protocol used by tools/provision.py: "key=value" stages a setting,
+// "erase" clears everything provisioned, "commit" writes the staged settings
+// and restarts, "abort" (or a timeout) returns without writing anything.
+// Every line except an empty one gets an "OK" or "ERR <reason>" reply.
+static void provision_run(void)
+{
+    char line[DEVICE_TOPIC_MAX + 16];
+    bool overflow;
+
+    uart_flush_input(STREAM_UART);
+    printf("PROVISION READY %d %s\n", sensor_manager_count(), device_config_trap_id());
+    fflush(stdout);
+
+    while (read_line(line, sizeof(line), &overflow)) {
+        esp_err_t ret;
+        char *value = strchr(line, '=');
+
+        if (overflow) {
+            ret = ESP_ERR_INVALID_SIZE;
+        } else if (line[0] == '\0') {
+            continue;
+        } else if (strcmp(line, "abort") == 0) {
+            break;
+        } else if (strcmp(line, "erase") == 0) {
+            ret = device_config_erase();
+        } else if (strcmp(line, "commit") == 0) {
+            ret = device_config_commit();
+            if (ret == ESP_OK) {
+                printf("OK restarting\n");
+                fflush(stdout);
+                vTaskDelay(pdMS_TO_TICKS(100));
+                esp_restart();
+            }
+        } else if (value) {
+            *value++ = '\0';
+            ret = device_config_set(line, value);
+        } else {
+            ret = ESP_ERR_INVALID_ARG;
+        }
+
+        if (ret == ESP_OK) {
+            printf("OK\n");
+        } else {
+            printf("ERR %s\n", esp_err_to_name(ret));
+        }
+        fflush(stdout);
+    }
+
+    device_config_discard();
+    printf("PROVISION ABORTED\n");
+}
+
 void diagnostic_mode_run(adc_oneshot_unit_handle_t adc1_handle)
 {
+    int count = sensor_manager_count();
+
     printf("\nEntering diagnostic mode - Press reset button to exit\n");
-    printf("Trap threshold: %d\n", TRAP_THRESHOLD);
-    printf("Battery threshold: %d\n", BATTERY_THRESHOLD);
+    printf("Trap ID: %s (%s)\n", device_config_trap_id(),
+           device_config_provisioned() ? "provisioned" : "build default");
+    for (int i = 0; i < count; i++) {
+        const sensor_config_t *sensor = sensor_manager_get(i);
+        printf("Sensor %d: %s %s %d, threshold %d, topic %s\n", i,
+               sensor->role == SENSOR_ROLE_TRAP ? "trap" : "battery",
+               sensor->source == SENSOR_SOURCE_WAKE_PIN ? "wake pin GPIO" : "ADC channel",
+               sensor->channel, sensor->threshold, sensor->topic);
+    }
+    printf("Commands: '%c' start binary sensor stream, 'l' dump binary log, '%c' provision\n",
+           STREAM_CMD_START, DIAG_CMD_PROVISION);
+    
+    if (diag_stream_init() != ESP_OK) {
+        printf("[%s] Failed to install UART driver - host commands disabled\n", TAG);
+    }
     
     #if USE_WAKE_CIRCUIT
-    // Configure wake pin as input if using wake circuit
+    // Wake pins are configured by sensor_manager_init; also read LDR1 so the
+    // comparator can be checked against the raw light level
     printf("Wake circuit enabled - using WAKE_PIN for trap detection\n");
-    gpio_config_t io_conf = {
-        .pin_bit_mask = (1ULL << WAKE_PIN),
-        .mode = GPIO_MODE_INPUT,
-        .pull_up_en = GPIO_PULLDOWN_DISABLE,
-        .pull_down_en = GPIO_PULLDOWN_ENABLE,
-        .intr_type = GPIO_INTR_DISABLE,
+    adc_oneshot_chan_cfg_t ldr1_config = {
+        .atten = ADC_ATTEN,
+        .bitwidth = ADC_BITWIDTH_DEFAULT,
     };
-    gpio_config(&io_conf);
+    adc_oneshot_config_channel(adc1_handle, LDR1_ADC_CHANNEL, &ldr1_config);
     #endif
     
     while (1) {
-        int reading1, reading2;
-        bool trap_triggered;
+        bool trap_triggered = false;
+        bool battery_low = false;
+
+        for (int i = 0; i < count; i++) {
+            const sensor_config_t *sensor = sensor_manager_get(i);
+            int reading = sensor_manager_read(adc1_handle, i);
+            bool active = reading > sensor->threshold;
+
+            if (sensor->role == SENSOR_ROLE_TRAP) {
+                trap_triggered |= active;
+            } else {
+                battery_low |= active;
+            }
+            printf("%sSensor %d: %d (%s)", i ? ", " : "", i, reading,
+                   sensor_manager_state_payload(i, active));
+        }
         
         #if USE_WAKE_CIRCUIT
-        // If wake circuit is enabled, use WAKE_PIN for trap detection
-        bool pin_state = gpio_get_level(WAKE_PIN);
-        trap_triggered = pin_state;
-        
-        // Still read LDR1 for informational purposes
-        ESP_ERROR_CHECK(adc_oneshot_read(adc1_handle, LDR1_ADC_CHANNEL, &reading1));
-        #else
-        // Use LDR1 for trap detection if no wake circuit
-        ESP_ERROR_CHECK(adc_oneshot_read(adc1_handle, LDR1_ADC_CHANNEL, &reading1));
-        trap_triggered = (reading1 > TRAP_THRESHOLD);
+        int reading1 = 0;
+        adc_oneshot_read(adc1_handle, LDR1_ADC_CHANNEL, &reading1);
+        printf(", LDR1: %d", reading1);
         #endif
+        printf("\n");
         
-        // Always use LDR2 for battery state
-        ESP_ERROR_CHECK(adc_oneshot_read(adc1_handle, LDR2_ADC_CHANNEL, &reading2));
-        bool battery_low = (reading2 > BATTERY_THRESHOLD);
-        
-        // Update LED with color-coded states
+        // Update LED with color-coded states (any trap triggered, any battery low)
         led_controller_set_diagnostic_state(trap_triggered, battery_low);
         
-        #if USE_WAKE_CIRCUIT
-        printf("Wake pin: %s, LDR1: %d, Battery sensor: %d (%s)\n",
-               trap_triggered ? "HIGH (TRIGGERED)" : "LOW (ready)",
-               reading1,
-               reading2, battery_low ? "LOW" : "ok");
-        #else
-        printf("Trap sensor: %d (%s), Battery sensor: %d (%s)\n",
-               reading1, trap_triggered ? "TRIGGERED" : "ready",
-               reading2, battery_low ? "LOW" : "ok");
-        #endif
-        
-        vTaskDelay(pdMS_TO_TICKS(500)); // Update every 500ms
+        // Update every 500ms, or sooner if the host sends a command
+        uint8_t cmd;
+        int len = uart_read_bytes(STREAM_UART, &cmd, 1, pdMS_TO_TICKS(500));
+        if (len < 0) {
+            vTaskDelay(pdMS_TO_TICKS(500)); // No UART driver
+        } else if (len == 1 && cmd == STREAM_CMD_START) {
+            diag_stream_run(adc1_handle);
+        } else if (len == 1 && cmd == 'l') {
+            binlog_flush_uart();
+        } else if (len == 1 && cmd == DIAG_CMD_PROVISION) {
+            provision_run();
+        }
     }
-}
\ No newline at end of file
+}
@@ -5,10 +5,14 @@
 #define LED_GPIO 2  // Built-in RGB LED
 
 static const char *TAG = "led_controller";
-static led_strip_handle_t led_strip;
+static led_strip_handle_t led_strip = NULL;
 
 esp_err_t led_controller_init(void)
 {
+    if (led_strip) {
+        return ESP_OK;
+    }
+
     /* LED strip initialization with the GPIO and pixels number*/
     led_strip_config_t strip_config = {
         .strip_gpio_num = LED_GPIO,
@@ -23,6 +27,7 @@ esp_err_t led_controller_init(void)
     esp_err_t ret = led_strip_new_rmt_device(&strip_config, &rmt_config, &led_strip);
     if (ret != ESP_OK) {
         if (DEBUG_LOGS) printf("[%s] Failed to initialize LED strip\n", TAG);
+        led_strip = NULL;
         return ret;
     }
 
@@ -35,6 +40,10 @@ esp_err_t led_controller_init(void)
 
 void led_controller_set_diagnostic_state(bool trap_triggered, bool battery_low)
 {
+    if (led_controller_init() != ESP_OK) {
+        return;
+    }
+
     if (trap_triggered && battery_low) {
         // Yellow for both sensors triggered
         led_strip_set_pixel(led_strip, 0, 32, 32, 0);
@@ -60,6 +69,10 @@ void led_controller_set_diagnostic_state(bool trap_triggered, bool battery_low)
 
 void led_controller_set_state(bool on)
 {
+    if (led_controller_init() != ESP_OK) {
+        return;
+    }
+
     if (on) {
         // Set white color at moderate brightness for diagnostic entry blinking
         led_strip_set_pixel(led_strip, 0, 16, 16, 16);
@@ -78,6 +91,10 @@ void led_controller_set_color(uint32_t color)
     uint8_t r = (color >> 16) & 0xFF;
     uint8_t g = (color >> 8) & 0xFF;
     uint8_t b = color & 0xFF;
+
+    if (led_controller_init() != ESP_OK) {
+        return;
+    }
     
     if (color == LED_COLOR_OFF) {
         led_strip_clear(led_strip);
@@ -0,0 +1,147 @@
+#include "link_adapt.h"
+#include "binlog.h"
+#include "esp_wifi.h"
+#include "nvs.h"
+
+typedef struct {
+    int8_t tx_quarter_dbm;      // esp_wifi_set_max_tx_power units
+    uint8_t protocol;
+} link_level_t;
+
+#define PROTOCOL_BGN (WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G | WIFI_PROTOCOL_11N)
+
+static const link_level_t levels[] = {
+    {8 * 4, PROTOCOL_BGN},
+    {11 * 4, PROTOCOL_BGN},
+    {14 * 4, PROTOCOL_BGN},
+    {17 * 4, PROTOCOL_BGN},
+    {20 * 4, PROTOCOL_BGN},
+#if LINK_ADAPT_11B_ONLY
+    {20 * 4, WIFI_PROTOCOL_11B},
+#endif
+};
+
+#define LEVEL_COUNT ((int)(sizeof(levels) / sizeof(levels[0])))
+#define START_LEVEL 4           // Full power, all modes: the IDF defaults
+#define FULL_TX_DBM 20          // Assumed AP TX power for the uplink estimate
+
+RTC_DATA_ATTR static link_adapt_stats_t stats;
+RTC_DATA_ATTR static bool level_loaded = false;
+
+static void set_level(int level)
+{
+    stats.level = level;
+    stats.tx_dbm = levels[level].tx_quarter_dbm / 4;
+    stats.protocol = levels[level].protocol;
+}
+
+// Start from the level learned before the last power-up, if any
+static void load_level(void)
+{
+    nvs_handle_t handle;
+    uint8_t level = START_LEVEL;
+
+    if (nvs_open(LINK_ADAPT_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+        if (nvs_get_u8(handle, "level", &level) != ESP_OK || level >= LEVEL_COUNT) {
+            level = START_LEVEL;
+        }
+        nvs_close(handle);
+    }
+    set_level(level);
+    level_loaded = true;
+}
+
+static void save_level(void)
+{
+    nvs_handle_t handle;
+    if (nvs_open(LINK_ADAPT_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK) {
+        if (nvs_set_u8(handle, "level", stats.level) == ESP_OK) {
+            nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+}
+
+static void change_level(int level)
+{
+    BINLOG_I(WIFI, LINK_LEVEL, stats.level, level, levels[level].tx_quarter_dbm / 4,
+             stats.rssi_avg_x16 / 16);
+    if (level > stats.level) {
+        stats.steps_up++;
+    } else {
+        stats.steps_down++;
+    }
+    set_level(level);
+    save_level();
+}
+
+void link_adapt_apply(bool started)
+{
+    if (!level_loaded) {
+        load_level();
+    }
+#if LINK_ADAPT_ENABLE
+    const link_level_t *level = &levels[stats.level];
+    esp_err_t ret = started ? esp_wifi_set_max_tx_power(level->tx_quarter_dbm)
+                            : esp_wifi_set_protocol(WIFI_IF_STA, level->protocol);
+    if (ret != ESP_OK) {
+        BINLOG_W(WIFI, LINK_APPLY_FAILED, stats.level, ret);
+    }
+#endif
+}
+
+void link_adapt_record(bool connected, int rssi, uint32_t connect_ms)
+{
+    if (!level_loaded) {
+        load_level();
+    }
+
+    stats.history = (stats.history << 1) | (connected ? 1 : 0);
+    if (stats.attempts < 8) {
+        stats.attempts++;
+    }
+
+    if (!connected) {
+        stats.failures++;
+        stats.streak = -LINK_ADAPT_HOLD_SESSIONS;
+        if (LINK_ADAPT_ENABLE && stats.level < LEVEL_COUNT - 1) {
+            change_level(stats.level + 1);
+        }
+        return;
+    }
+
+    stats.last_rssi = rssi;
+    stats.last_connect_ms = connect_ms;
+    if (stats.rssi_avg_x16 == 0) {
+        stats.rssi_avg_x16 = rssi * 16;
+    } else {
+        stats.rssi_avg_x16 += (rssi * 16 - stats.rssi_avg_x16) / 4;
+    }
+    if (stats.streak < INT16_MAX) {
+        stats.streak++;
+    }
+
+    // Step down once the link has been reliable for a while and the AP would
+    // still hear the lower TX power well enough
+    if (LINK_ADAPT_ENABLE && stats.level > 0 && stats.streak >= LINK_ADAPT_STEP_DOWN_AFTER) {
+        int next = stats.level - 1;
+        int uplink = stats.rssi_avg_x16 / 16 - (FULL_TX_DBM - levels[next].tx_quarter_dbm / 4);
+        if (uplink >= LINK_ADAPT_MIN_RSSI) {
+            change_level(next);
+            stats.streak = 0;
+        }
+    }
+}
+
+const link_adapt_stats_t *link_adapt_stats(void)
+{
+    if (!level_loaded) {
+        load_level();
+    }
+    return &stats;
+}
+
+const char *link_adapt_protocol_name(void)
+{
+    return stats.protocol == WIFI_PROTOCOL_11B ? "b" : "bgn";
+}
@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "nvs_flash.h"
 #include "esp_sleep.h"
 #include "esp_log.h"
@@ -7,16 +9,22 @@
 
 #include "wifi_manager.h"
 #include "mqtt_manager.h"
+#include "device_config.h"
 #include "sensor_manager.h"
 #include "led_controller.h"
 #include "diagnostic.h"
+#include "binlog.h"
+#include "cycle_supervisor.h"
+#include "telemetry.h"
+#include "ota_manager.h"
+#include "boot_timing.h"
+#include "publish_policy.h"
+#include "power_governor.h"
+#include "trigger_latency.h"
 #include "config.h"
 
-static const char *TAG = "main";
-
 // Store states in RTC memory to persist during deep sleep
-RTC_DATA_ATTR static bool last_trap_state = false;
-RTC_DATA_ATTR static bool last_battery_state = false;
+RTC_DATA_ATTR static bool last_state[SENSOR_MAX_CHANNELS] = {false};
 RTC_DATA_ATTR static bool initialized = false;
 RTC_DATA_ATTR static uint16_t cycles_since_publish = 0;
 
@@ -24,22 +32,79 @@ RTC_DATA_ATTR static uint16_t cycles_since_publish = 0;
 #define CYCLES_PER_HOUR (3600 / SLEEP_TIME_SECONDS)
 #define CYCLES_FOR_PUBLISH (CYCLES_PER_HOUR * HEARTBEAT_INTERVAL_HOURS)
 
-// For wake circuit mode, we can use a longer sleep time since we don't need to poll
-// We'll wake up once per heartbeat interval (in seconds) to check battery and publish heartbeat
-#define WAKE_CIRCUIT_SLEEP_TIME_SECONDS (HEARTBEAT_INTERVAL_HOURS * 3600)
+// Upload the encoded burst traces on heartbeat or when requested via a
+// retained flag (request is its payload, NULL if none), so thresholds can be
+// checked remotely
+static void upload_burst_trace(bool heartbeat, const char *request)
+{
+    bool requested = request && request[0] != '\0' && strcmp(request, "0") != 0;
+
+    if (!requested && !(heartbeat && TRACE_UPLOAD_ON_HEARTBEAT)) {
+        return;
+    }
+
+    size_t size = sensor_manager_trace_size();
+    uint8_t *blob = size ? malloc(size) : NULL;
+    if (blob && sensor_manager_trace_snapshot(blob, size) == size) {
+        BINLOG_I(MAIN, TRACE_UPLOAD, (int)size);
+
+        // Retained, so the trace can be fetched whenever convenient; the
+        // buffer is only cleared once the broker has it
+        if (mqtt_manager_publish_data_tracked(device_config_topic(DEVICE_TOPIC_TRACE), blob, size, 1) &&
+            mqtt_manager_wait_acked(MQTT_UPLOAD_ACK_TIMEOUT_MS) >= 0) {
+            sensor_manager_trace_clear();
+            if (requested) {
+                // Clear the retained request so the upload only happens once
+                mqtt_manager_publish(device_config_topic(DEVICE_TOPIC_TRACE_REQUEST), "", 1, 1);
+            }
+        } else {
+            BINLOG_W(MAIN, UPLOAD_NO_PUBACK, MQTT_UPLOAD_ACK_TIMEOUT_MS);
+        }
+    }
+    free(blob);
+}
+
+// Initialize NVS once per boot (needed for WiFi and to read the device config)
+static bool nvs_ready = false;
 
-static void publish_sensor_states(sensor_data_t *sensor1, sensor_data_t *sensor2)
+static void init_nvs(void)
 {
-    bool trap_triggered = sensor_manager_is_trap_triggered(sensor1);
-    bool battery_low = sensor_manager_is_battery_low(sensor2);
-    
-    if (DEBUG_LOGS) {
-        printf("[%s] Current states - Trap: %s, Battery: %s\n",
-               TAG, trap_triggered ? "triggered" : "ready",
-               battery_low ? "low" : "ok");
-        printf("[%s] Previous states - Trap: %s, Battery: %s\n",
-               TAG, last_trap_state ? "triggered" : "ready",
-               last_battery_state ? "low" : "ok");
+    if (nvs_ready) {
+        return;
+    }
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        CYCLE_CHECK(nvs_flash_erase());
+        ret = nvs_flash_init();
+    }
+    CYCLE_CHECK(ret);
+    nvs_ready = true;
+}
+
+// Bring up Wi-Fi and MQTT; on failure both are shut down again
+static bool connect_session(void)
+{
+    cycle_supervisor_set_phase(CYCLE_PHASE_WIFI);
+    if (!wifi_manager_init()) {
+        return false;
+    }
+    cycle_supervisor_set_phase(CYCLE_PHASE_MQTT);
+    if (!mqtt_manager_init()) {
+        mqtt_manager_cleanup();
+        wifi_manager_stop();
+        return false;
+    }
+    return true;
+}
+
+static void publish_sensor_states(const sensor_data_t *data)
+{
+    int count = sensor_manager_count();
+    bool state[SENSOR_MAX_CHANNELS];
+
+    for (int i = 0; i < count; i++) {
+        state[i] = sensor_manager_is_active(i, &data[i]);
+        BINLOG_D(MAIN, SENSOR_STATE, i, state[i], last_state[i]);
     }
 
     // Check if this is first boot since power-up
@@ -54,148 +119,195 @@ static void publish_sensor_states(sensor_data_t *sensor1, sensor_data_t *sensor2
     if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER) {
         // If we woke up from timer with wake circuit enabled, it's time for a heartbeat
         heartbeat_due = true;
-        if (DEBUG_LOGS) {
-            printf("[%s] Timer wakeup with wake circuit - forcing heartbeat\n", TAG);
-        }
+        BINLOG_D(MAIN, HEARTBEAT_FORCED);
     }
     #endif
     
-    if (DEBUG_LOGS) {
-        printf("[%s] Cycles since last publish: %d/%d\n",
-               TAG, cycles_since_publish, CYCLES_FOR_PUBLISH);
-    }
+    // Heartbeats are spaced out further as the supply runs down
+    unsigned cycles_for_publish = CYCLES_FOR_PUBLISH * power_governor_heartbeat_scale();
+    BINLOG_D(MAIN, CYCLES, cycles_since_publish, cycles_for_publish);
+
+    const publish_context_t context = {
+        .first_boot = is_first_boot,
+        .heartbeat_due = heartbeat_due,
+        .cycles_since_publish = cycles_since_publish,
+        .cycles_for_publish = cycles_for_publish,
+    };
+    publish_decision_t decision = publish_policy_decide(&context, state, last_state, count);
     
-    // Connect and publish if states changed, first boot, heartbeat due, or enough cycles elapsed
-    if (trap_triggered != last_trap_state ||
-        battery_low != last_battery_state ||
-        is_first_boot ||
-        heartbeat_due ||
-        cycles_since_publish >= CYCLES_FOR_PUBLISH) {
+    // Connect and publish if any state changed or a full publish is due
+    if (decision.connect) {
         
         // Set initialized flag on first boot
         if (is_first_boot) {
             initialized = true;
         }
         
-        bool connected = false;
+        bool ota_installed = false;
 
         // Initialize NVS (needed for WiFi)
-        esp_err_t ret = nvs_flash_init();
-        if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-            ESP_ERROR_CHECK(nvs_flash_erase());
-            ret = nvs_flash_init();
-        }
-        ESP_ERROR_CHECK(ret);
-        
+        init_nvs();
+
         // Initialize WiFi and MQTT only when needed
-        if (wifi_manager_init()) {
-            if (mqtt_manager_init()) {
-                connected = true;
-                
-                // Publish trap state if changed, first boot, heartbeat due, or heartbeat interval reached
-                if (trap_triggered != last_trap_state || is_first_boot || heartbeat_due || cycles_since_publish >= CYCLES_FOR_PUBLISH) {
-                    const char *trap_state = trap_triggered ? "triggered" : "ready";
-                    if (DEBUG_LOGS) printf("[%s] Publishing trap state: %s to topic: %s\n",
-                                         TAG, trap_state, MQTT_TOPIC_CAUGHT);
-                    if (mqtt_manager_publish(MQTT_TOPIC_CAUGHT, trap_state, 1, 1)) {
-                        last_trap_state = trap_triggered;
-                        if (DEBUG_LOGS) printf("[%s] Successfully published trap state\n", TAG);
-                    }
-                }
+        bool connected = connect_session();
 
-                // Publish battery state if changed, first boot, heartbeat due, or heartbeat interval reached
-                if (battery_low != last_battery_state || is_first_boot || heartbeat_due || cycles_since_publish >= CYCLES_FOR_PUBLISH) {
-                    const char *battery_state = battery_low ? "low" : "ok";
-                    if (DEBUG_LOGS) printf("[%s] Publishing battery state: %s to topic: %s\n",
-                                         TAG, battery_state, MQTT_TOPIC_BATTERY);
-                    if (mqtt_manager_publish(MQTT_TOPIC_BATTERY, battery_state, 1, 1)) {
-                        last_battery_state = battery_low;
-                        if (DEBUG_LOGS) printf("[%s] Successfully published battery state\n", TAG);
+        // A freshly updated image is rolled back if it cannot publish. A failed
+        // connect is more likely the network than the image, so keep trying
+        // for up to CYCLE_BUDGET_OTA_MS before giving up on it
+        if (!connected && ota_manager_pending_verify()) {
+            cycle_supervisor_extend(CYCLE_BUDGET_OTA_MS);
+            for (int attempt = 1; !connected && !cycle_supervisor_expired() &&
+                                  cycle_supervisor_remaining_ms() > OTA_CONFIRM_RETRY_MS; attempt++) {
+                BINLOG_W(OTA, OTA_CONFIRM_RETRY, attempt, cycle_supervisor_remaining_ms());
+                vTaskDelay(pdMS_TO_TICKS(OTA_CONFIRM_RETRY_MS));
+                connected = connect_session();
+            }
+        }
+
+        if (connected) {
+            cycle_supervisor_set_phase(CYCLE_PHASE_PUBLISH);
+            
+            // Publish each sensor whose state changed, or all of them when a full publish is due.
+            // A triggering sensor's publish is tracked until its PUBACK for the latency report.
+            uint32_t triggered = trigger_latency_pending();
+            for (int i = 0; i < count; i++) {
+                if (decision.publish_mask & BIT(i)) {
+                    BINLOG_D(MAIN, PUBLISH_SENSOR, i, state[i]);
+                    const char *topic = sensor_manager_get(i)->topic;
+                    const char *payload = sensor_manager_state_payload(i, state[i]);
+                    if ((triggered & BIT(i)) ? mqtt_manager_publish_tracked(topic, payload, 1)
+                                             : mqtt_manager_publish(topic, payload, 1, 1)) {
+                        last_state[i] = state[i];
+                        BINLOG_D(MAIN, PUBLISH_SENSOR_OK, i);
                     }
                 }
+            }
+
+            // Trigger time and trigger-to-PUBACK latency
+            trigger_latency_report();
+
+            // Keep a freshly updated image now that it has published
+            ota_manager_confirm(true);
+
+            // Device health (awake time, budget overruns, resets)
+            telemetry_publish();
+
+            // Uploads and updates are left out once the supply runs low
+            if (power_governor_allow_optional()) {
+                // Check the retained requests with one subscription. Firmware
+                // updates are only pulled in full publish sessions.
+                char log_request[16];
+                char trace_request[16];
+                char ota_request[OTA_REQUEST_MAX];
+                mqtt_request_t requests[] = {
+                    { device_config_topic(DEVICE_TOPIC_LOG_REQUEST), log_request, sizeof(log_request), -1 },
+                    { device_config_topic(DEVICE_TOPIC_TRACE_REQUEST), trace_request, sizeof(trace_request), -1 },
+                    { device_config_topic(DEVICE_TOPIC_OTA), ota_request, sizeof(ota_request), -1 },
+                };
+                bool check_ota = OTA_ENABLE && decision.publish_all;
+                mqtt_manager_fetch_requests(requests, check_ota ? 3 : 2, 1000);
+
+                // Upload the binary log if one was requested
+                binlog_handle_upload_request(requests[0].len > 0 ? log_request : NULL);
+
+                // Upload burst traces on heartbeat or request
+                upload_burst_trace(decision.heartbeat, requests[1].len > 0 ? trace_request : NULL);
 
-                // Reset cycle counter after successful publish
-                cycles_since_publish = 0;
-                
-                // Wait for messages to be sent
-                vTaskDelay(pdMS_TO_TICKS(2000));
-                mqtt_manager_cleanup();
+                if (check_ota) {
+                    ota_installed = ota_manager_check(requests[2].len > 0 ? ota_request : NULL);
+                }
+            } else {
+                BINLOG_I(POWER, OPTIONAL_SKIPPED, power_governor_stage());
             }
+
+            // Reset cycle counter after successful publish
+            cycles_since_publish = 0;
+            
+            // Wait for messages to be sent, within what is left of the budget
+            int settle_ms = cycle_supervisor_remaining_ms();
+            vTaskDelay(pdMS_TO_TICKS(settle_ms < 2000 ? settle_ms : 2000));
+            mqtt_manager_cleanup();
             wifi_manager_stop();
+        } else {
+            BINLOG_W(MAIN, PUBLISH_FAILED);
+
+            // A freshly updated image that cannot publish is rolled back
+            ota_manager_confirm(false);
         }
-        
-        if (!connected) {
-            if (DEBUG_LOGS) printf("[%s] Failed to connect - will retry on next state change\n", TAG);
+
+        if (ota_installed) {
+            BINLOG_I(OTA, OTA_RESTART);
+            esp_restart();
         }
     } else {
-        if (DEBUG_LOGS) printf("[%s] No state changes detected, skipping publish\n", TAG);
+        BINLOG_D(MAIN, PUBLISH_SKIPPED);
     }
 }
 
-// Flag to track if device was woken by wake circuit
-static bool woken_by_wake_circuit = false;
+// Wake pins that triggered this wake-up (wake circuit sensors)
+static uint64_t wake_gpio_mask = 0;
 
 static void check_wakeup_cause(void) {
     esp_sleep_wakeup_cause_t wakeup_reason = esp_sleep_get_wakeup_cause();
     
-    // Reset wake circuit flag
-    woken_by_wake_circuit = false;
+    // Reset wake circuit pins
+    wake_gpio_mask = 0;
     
-    // Always log wakeup reason for debugging
-    printf("[%s] Wake up reason: ", TAG);
+    // The wake cause itself is recorded in the binlog boot record
     switch(wakeup_reason) {
         case ESP_SLEEP_WAKEUP_EXT0:
-            printf("external signal using RTC_IO (wake circuit)\n");
-            woken_by_wake_circuit = true;
+            wake_gpio_mask = sensor_manager_wake_pin_mask();
             break;
-        case ESP_SLEEP_WAKEUP_GPIO:
-            printf("GPIO wakeup (wake circuit)\n");
-            
-            // For GPIO wakeup, we can check which pin triggered the wakeup
+        case ESP_SLEEP_WAKEUP_GPIO: {
+            // For GPIO wakeup, we can check which pins triggered the wakeup
             uint64_t wakeup_pin_mask = esp_sleep_get_gpio_wakeup_status();
             if (wakeup_pin_mask != 0) {
-                int pin = __builtin_ffsll(wakeup_pin_mask) - 1;
-                printf("[%s] Wakeup from GPIO %d\n", TAG, pin);
-                if (pin == WAKE_PIN) {
-                    woken_by_wake_circuit = true;
-                    printf("[%s] Setting woken_by_wake_circuit to true\n", TAG);
-                }
+                BINLOG_I(MAIN, WAKE_GPIO, __builtin_ffsll(wakeup_pin_mask) - 1);
+                wake_gpio_mask = wakeup_pin_mask & sensor_manager_wake_pin_mask();
             }
             break;
-        case ESP_SLEEP_WAKEUP_TIMER:
-            printf("timer\n");
-            break;
-        case ESP_SLEEP_WAKEUP_UNDEFINED:
-            printf("undefined (first boot)\n");
-            break;
+        }
         default:
-            printf("other reason (%d)\n", wakeup_reason);
             break;
     }
     
-    // If woken up by wake circuit (either EXT0 or GPIO depending on chip)
-    if (woken_by_wake_circuit) {
-        printf("[%s] Wakeup triggered by wake circuit - trap state will be published\n", TAG);
-        last_trap_state = false; // Force state change to trigger publish
+    if (wake_gpio_mask) {
+        BINLOG_I(MAIN, WAKE_CIRCUIT);
     }
 }
 
 void app_main(void)
 {
-    // Early check for wake circuit configuration
-    printf("[%s] USE_WAKE_CIRCUIT=%d\n", TAG, USE_WAKE_CIRCUIT);
+    // Start a new binlog boot sequence (records wake cause and configuration)
+    binlog_init();
+
+    // Record how long the bootloader and startup took to reach app_main
+    boot_timing_record();
+    trigger_latency_capture();
+
+    // Start the awake-time budget for this cycle
+    cycle_supervisor_start();
+
+    // Identity, topics and thresholds; build defaults if not provisioned.
+    // Deep sleep wakes take them from RTC memory without touching NVS.
+    if (!device_config_cached()) {
+        init_nvs();
+    }
+    device_config_load();
     
     // Normal operation mode
     
     // Initialize ADC
     adc_oneshot_unit_handle_t adc1_handle;
-    ESP_ERROR_CHECK(sensor_manager_init(&adc1_handle));
+    CYCLE_CHECK(sensor_manager_init(&adc1_handle));
+
+    // Measure the supply and choose this wake's power stage
+    power_governor_update(adc1_handle);
 
     // Only on first power-up: Initialize diagnostic mode and check for entry
     if (!initialized) {
-        // Initialize diagnostic button and LED
-        ESP_ERROR_CHECK(diagnostic_mode_init());
-        ESP_ERROR_CHECK(led_controller_init());
+        // Initialize diagnostic button (the LED initializes on first use)
+        CYCLE_CHECK(diagnostic_mode_init());
 
         bool enter_diagnostic = diagnostic_mode_check_entry();
         
@@ -205,98 +317,41 @@ void app_main(void)
             gpio_reset_pin(GPIO_NUM_1);      // Reset TX pin
             gpio_reset_pin(GPIO_NUM_3);      // Reset RX pin
         } else {
+            // Diagnostic mode runs until reset, without an awake budget
+            cycle_supervisor_cancel();
+
+            // Dump the log buffer: records kept across resets (including
+            // the cycle that crashed or was reset) up to this boot
+            binlog_flush_uart();
             diagnostic_mode_run(adc1_handle);
             esp_restart(); // If we ever exit diagnostic mode, restart the device
         }
-    } else {
-        // Initialize LED controller for wake circuit
-        #if USE_WAKE_CIRCUIT
-        ESP_ERROR_CHECK(led_controller_init());
-        #endif
     }
 
     // Check wake-up cause
     check_wakeup_cause();
 
-    // Choose operation mode based on wake circuit configuration
-    #if USE_WAKE_CIRCUIT
-        // Main operation loop with wake circuit
-        sensor_data_t sensor1_data, sensor2_data;
-        
-        // Only sample battery state, trap state comes from wake pin
-        sensor_manager_sample_battery(adc1_handle, &sensor2_data);
-        
-        // Set sensor1 data based on wake pin or wake circuit trigger
-        int wake_pin_level = gpio_get_level(WAKE_PIN);
-        
-        // Debug the wake circuit status
-        printf("[%s] Wake pin level: %d, woken by wake circuit: %d\n",
-               TAG, wake_pin_level, woken_by_wake_circuit);
-               
-        // Consider trap triggered if either:
-        // 1. Current wake pin level is HIGH, or
-        // 2. Device was woken by the wake circuit (even if pin is now LOW)
-        if (wake_pin_level || woken_by_wake_circuit) {
-            sensor1_data.max_value = TRAP_THRESHOLD + 100;
-        } else {
-            sensor1_data.max_value = 0;
-        }
-        
-        printf("[%s] Setting sensor1 max_value to %d\n", TAG, sensor1_data.max_value);
-        
-        // Publish results if needed
-        publish_sensor_states(&sensor1_data, &sensor2_data);
-        
-        // Configure wake-up sources
-        // ESP32-C3 doesn't support ext0 wakeup, use gpio wakeup instead
-        
-        // Properly configure the GPIO pin first
-        const gpio_config_t wake_pin_config = {
-            .pin_bit_mask = BIT(WAKE_PIN),
-            .mode = GPIO_MODE_INPUT,
-            .pull_up_en = GPIO_PULLUP_DISABLE,
-            .pull_down_en = GPIO_PULLDOWN_ENABLE,  // Pull down to ensure stable LOW when not triggered
-            .intr_type = GPIO_INTR_DISABLE,
-        };
-        ESP_ERROR_CHECK(gpio_config(&wake_pin_config));
-        
-        // Read current state for debugging
-        int pin_level = gpio_get_level(WAKE_PIN);
-        printf("[%s] Current wake pin level: %d\n", TAG, pin_level);
-        
-        // Enable wakeup using the proper ESP-IDF function for ESP32-C3
-        ESP_ERROR_CHECK(esp_deep_sleep_enable_gpio_wakeup(BIT(WAKE_PIN), ESP_GPIO_WAKEUP_GPIO_HIGH));
-        ESP_ERROR_CHECK(esp_sleep_enable_timer_wakeup(WAKE_CIRCUIT_SLEEP_TIME_SECONDS * 1000000ULL));  // Wake for heartbeat
-        
-        // Go to deep sleep
-        if (DEBUG_LOGS) {
-            printf("[%s] Going to sleep for %d hours (or until wake pin triggers)\n",
-                   TAG, HEARTBEAT_INTERVAL_HOURS);
-        } else {
-            printf("[%s] Entering deep sleep\n", TAG);
-        }
-        
-        // Small delay to ensure logs are printed
-        vTaskDelay(pdMS_TO_TICKS(100));
-        
-        esp_deep_sleep_start();
-    #else
-        // Original behavior without wake circuit
-        // Main operation loop
-        while (1) {
-            sensor_data_t sensor1_data, sensor2_data;
-            
-            // Perform burst sampling
-            sensor_manager_burst_sample(adc1_handle, &sensor1_data, &sensor2_data);
-            
-            // Publish results if needed
-            publish_sensor_states(&sensor1_data, &sensor2_data);
-            
-            // Go to deep sleep
-            if (DEBUG_LOGS) {
-                printf("[%s] Going to sleep for %d seconds\n", TAG, SLEEP_TIME_SECONDS);
+    // Sample every sensor in the table (wake pin sensors are read from their GPIO)
+    sensor_data_t sensor_data[SENSOR_MAX_CHANNELS];
+    cycle_supervisor_set_phase(CYCLE_PHASE_SAMPLING);
+    sensor_manager_burst_sample(adc1_handle, sensor_data);
+
+    // Consider a wake pin sensor triggered if either its pin is HIGH during
+    // the burst, or it woke the device (even if the pin is now LOW)
+    uint32_t woken = sensor_manager_mark_woken(wake_gpio_mask, sensor_data);
+    if (woken) {
+        BINLOG_I(MAIN, WAKE_SENSORS, woken);
+        trigger_latency_set_sensors(woken);
+        for (int i = 0; i < sensor_manager_count(); i++) {
+            if (woken & (1u << i)) {
+                last_state[i] = false; // Force state change to trigger publish
             }
-            esp_deep_sleep(SLEEP_TIME_SECONDS * 1000000);
         }
-    #endif // End of wake circuit configuration
+    }
+
+    // Publish results if needed
+    publish_sensor_states(sensor_data);
+
+    // Configure wake pins and the sleep timer, then go to deep sleep
+    cycle_supervisor_sleep();
 }
\ No newline at end of file
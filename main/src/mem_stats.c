@@ -0,0 +1,48 @@
+#include "mem_stats.h"
+#include "esp_heap_caps.h"
+
+RTC_DATA_ATTR static mem_stats_t stats;
+
+#define MEM_STATS_TASK_NAME(name, str) [MEM_STATS_TASK_##name] = str,
+
+static const char *task_names[] = {
+    MEM_STATS_TASKS(MEM_STATS_TASK_NAME)
+};
+
+void mem_stats_sample(void)
+{
+    // The heap minimum covers the whole wake, so sampling late is enough
+    uint32_t min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    stats.heap_min_free_cycle = min_free;
+    if (stats.heap_min_free == 0 || min_free < stats.heap_min_free) {
+        stats.heap_min_free = min_free;
+    }
+    stats.heap_largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+
+    // Stacks are only visible while their task exists (e.g. mqtt_task
+    // between mqtt_manager_init and mqtt_manager_cleanup)
+    for (int i = 0; i < MEM_STATS_TASK_COUNT; i++) {
+        TaskHandle_t task = xTaskGetHandle(task_names[i]);
+        if (!task) {
+            continue;
+        }
+        // ESP-IDF reports the high-water mark in bytes
+        uint32_t free_bytes = uxTaskGetStackHighWaterMark(task);
+        if (free_bytes > UINT16_MAX) {
+            free_bytes = UINT16_MAX;
+        }
+        if (stats.stack_min_free[i] == 0 || free_bytes < stats.stack_min_free[i]) {
+            stats.stack_min_free[i] = free_bytes;
+        }
+    }
+}
+
+const mem_stats_t *mem_stats_get(void)
+{
+    return &stats;
+}
+
+const char *mem_stats_task_name(mem_stats_task_t task)
+{
+    return task < MEM_STATS_TASK_COUNT ? task_names[task] : "unknown";
+}
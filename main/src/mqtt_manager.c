@@ -1,13 +1,52 @@
 #include "mqtt_manager.h"
+#include "binlog.h"
+#include "device_config.h"
+#include "cycle_supervisor.h"
+#include "power_governor.h"
 #include "secrets.h"
 #include "config.h"
 #include <stdio.h>
 #include <string.h>
+#include "esp_timer.h"
+#include "freertos/semphr.h"
 
-static const char *TAG = "mqtt_manager";
 esp_mqtt_client_handle_t mqtt_client = NULL;
 static bool mqtt_connected = false;
 
+// One topic of a pending retained-message fetch
+typedef struct {
+    const char *topic;
+    mqtt_stream_cb_t cb;
+    void *ctx;
+    volatile int len;                     // Payload length once complete, else -1
+    volatile bool failed;                 // cb abandoned the message
+} retained_fetch_t;
+
+// Pending retained-message fetch (see fetch_retained_topics)
+static retained_fetch_t *retained_fetches = NULL;
+static int retained_count = 0;
+static SemaphoreHandle_t retained_lock = NULL;
+static int retained_active = -1;          // Fetch the current fragments belong to
+static volatile bool retained_receiving = false;
+static volatile int retained_sub_msg_id = -1;
+static volatile bool retained_subscribed = false;
+
+// PUBACK time of the tracked publish, recorded by the event handler. PUBACKs
+// that arrive while esp_mqtt_client_publish has not yet returned the tracked
+// message ID are kept as early acks and matched once the ID is known.
+#define EARLY_ACKS 8
+static portMUX_TYPE ack_lock = portMUX_INITIALIZER_UNLOCKED;
+static int tracked_msg_id = -1;
+static bool tracked_pending = false;      // Tracked publish in progress, ID unknown
+static volatile int64_t tracked_ack_us = -1;
+static int early_ack_id[EARLY_ACKS];
+static int64_t early_ack_us[EARLY_ACKS];
+static int early_acks = 0;
+
+// Retained messages follow the SUBACK immediately, so once the subscription
+// is acknowledged only a short grace period is needed to rule one out
+#define RETAINED_GRACE_MS 200
+
 void mqtt_manager_event_handler(void *handler_args, esp_event_base_t base,
                                int32_t event_id, void *event_data)
 {
@@ -16,26 +55,73 @@ void mqtt_manager_event_handler(void *handler_args, esp_event_base_t base,
     
     switch (event->event_id) {
         case MQTT_EVENT_CONNECTED:
-            if (DEBUG_LOGS) printf("[%s] MQTT Connected\n", TAG);
+            BINLOG_D(MQTT, MQTT_CONNECTED);
             mqtt_connected = true;
             if (connection_established != NULL) {
                 *connection_established = true;
             }
             // Publish online status when connected
-            esp_mqtt_client_publish(event->client, MQTT_TOPIC_AVAILABILITY, "online", 0, 1, 1);
+            esp_mqtt_client_publish(event->client, device_config_topic(DEVICE_TOPIC_AVAILABILITY),
+                                    "online", 0, 1, 1);
             break;
         case MQTT_EVENT_DISCONNECTED:
-            if (DEBUG_LOGS) printf("[%s] MQTT Disconnected\n", TAG);
+            BINLOG_D(MQTT, MQTT_DISCONNECTED);
             mqtt_connected = false;
             if (connection_established != NULL) {
                 *connection_established = false;
             }
             break;
         case MQTT_EVENT_ERROR:
-            if (DEBUG_LOGS) printf("[%s] MQTT Error occurred\n", TAG);
+            BINLOG_D(MQTT, MQTT_ERROR);
             break;
         case MQTT_EVENT_PUBLISHED:
-            if (DEBUG_LOGS) printf("[%s] MQTT Message published successfully\n", TAG);
+            BINLOG_D(MQTT, MQTT_PUBLISHED, event->msg_id);
+            portENTER_CRITICAL(&ack_lock);
+            if (event->msg_id == tracked_msg_id) {
+                tracked_ack_us = esp_timer_get_time();
+            } else if (tracked_pending && early_acks < EARLY_ACKS) {
+                early_ack_id[early_acks] = event->msg_id;
+                early_ack_us[early_acks] = esp_timer_get_time();
+                early_acks++;
+            }
+            portEXIT_CRITICAL(&ack_lock);
+            break;
+        case MQTT_EVENT_SUBSCRIBED:
+            if (event->msg_id == retained_sub_msg_id) {
+                retained_subscribed = true;
+            }
+            break;
+        case MQTT_EVENT_DATA:
+            // Large messages arrive in buffer-sized fragments and only the
+            // first one carries the topic
+            if (!retained_lock || xSemaphoreTake(retained_lock, portMAX_DELAY) != pdTRUE) {
+                break;
+            }
+            if (event->current_data_offset == 0) {
+                retained_active = -1;
+                for (int i = 0; i < retained_count; i++) {
+                    const char *topic = retained_fetches[i].topic;
+                    if (event->topic_len == (int)strlen(topic) &&
+                        strncmp(event->topic, topic, event->topic_len) == 0) {
+                        retained_active = i;
+                    }
+                }
+            }
+            if (retained_active >= 0) {
+                retained_fetch_t *fetch = &retained_fetches[retained_active];
+                if (fetch->len < 0 && !fetch->failed) {
+                    retained_receiving = true;
+                    if (!fetch->cb(fetch->ctx, (const uint8_t *)event->data, event->data_len,
+                                   event->current_data_offset, event->total_data_len)) {
+                        fetch->failed = true;
+                        retained_receiving = false;
+                    } else if (event->current_data_offset + event->data_len >= event->total_data_len) {
+                        fetch->len = event->total_data_len;
+                        retained_receiving = false;
+                    }
+                }
+            }
+            xSemaphoreGive(retained_lock);
             break;
         default:
             break;
@@ -45,19 +131,40 @@ void mqtt_manager_event_handler(void *handler_args, esp_event_base_t base,
 bool mqtt_manager_init(void)
 {
     esp_mqtt_client_config_t mqtt_cfg = {
+#if MQTT_USE_TLS
+        .broker.address.uri = "mqtts://" MQTT_BROKER,
+#else
         .broker.address.uri = "mqtt://" MQTT_BROKER,
+#endif
         .broker.address.port = MQTT_PORT,
         .credentials.username = MQTT_USERNAME,
         .credentials.authentication.password = MQTT_PASSWORD,
-        .session.last_will.topic = MQTT_TOPIC_AVAILABILITY,
+        .session.last_will.topic = device_config_topic(DEVICE_TOPIC_AVAILABILITY),
         .session.last_will.msg = "offline",
         .session.last_will.qos = 1,
         .session.last_will.retain = 1
     };
 
+#if LOW_MEMORY_MODE
+    // Fixed sizes instead of the defaults, so the footprint is known up front
+    mqtt_cfg.buffer.size = MQTT_BUFFER_SIZE;
+    mqtt_cfg.buffer.out_size = MQTT_BUFFER_SIZE;
+    mqtt_cfg.outbox.limit = MQTT_OUTBOX_LIMIT;
+    mqtt_cfg.task.stack_size = MQTT_TASK_STACK_SIZE;
+#endif
+
+#if MQTT_USE_TLS
+    // TLS transport that resumes the session cached in RTC memory
+    mqtt_cfg.network.transport = mqtt_tls_transport_create();
+    if (!mqtt_cfg.network.transport) {
+        BINLOG_E(MQTT, MQTT_TRANSPORT_FAILED);
+        return false;
+    }
+#endif
+
     mqtt_client = esp_mqtt_client_init(&mqtt_cfg);
     if (!mqtt_client) {
-        printf("[%s] Failed to initialize MQTT client\n", TAG);
+        BINLOG_E(MQTT, MQTT_INIT_FAILED);
         return false;
     }
 
@@ -66,7 +173,7 @@ bool mqtt_manager_init(void)
                                   mqtt_manager_event_handler, &mqtt_connected);
     
     if (esp_mqtt_client_start(mqtt_client) != ESP_OK) {
-        printf("[%s] Failed to start MQTT client\n", TAG);
+        BINLOG_E(MQTT, MQTT_START_FAILED);
         esp_mqtt_client_destroy(mqtt_client);
         mqtt_client = NULL;
         return false;
@@ -74,21 +181,20 @@ bool mqtt_manager_init(void)
 
     // Give more time for the connection to establish
     int retry_count = 0;
-    const int max_retries = 5;  // 5 * 2 seconds = 10 second timeout
+    const int max_retries = power_governor_retries(5);  // 5 * 2 seconds = 10 seconds, less in low power stages
     
-    while (retry_count < max_retries && !mqtt_connected) {
-        if (DEBUG_LOGS) printf("[%s] Waiting for MQTT connection... (%d/%d)\n", 
-                              TAG, retry_count + 1, max_retries);
+    while (retry_count < max_retries && !mqtt_connected && !cycle_supervisor_expired()) {
+        BINLOG_D(MQTT, MQTT_WAITING, retry_count + 1, max_retries);
         vTaskDelay(pdMS_TO_TICKS(2000));
         retry_count++;
     }
     
     if (mqtt_connected) {
-        if (DEBUG_LOGS) printf("[%s] MQTT connected successfully\n", TAG);
+        BINLOG_D(MQTT, MQTT_CONNECT_OK);
         return true;
     }
     
-    printf("[%s] MQTT connection timeout after %d seconds\n", TAG, max_retries * 2);
+    BINLOG_E(MQTT, MQTT_TIMEOUT, max_retries * 2);
     return false;
 }
 
@@ -102,6 +208,191 @@ bool mqtt_manager_publish(const char *topic, const char *message, int qos, int r
     return (msg_id != -1);
 }
 
+bool mqtt_manager_publish_tracked(const char *topic, const char *message, int retain)
+{
+    return mqtt_manager_publish_data_tracked(topic, message, 0, retain);
+}
+
+bool mqtt_manager_publish_data_tracked(const char *topic, const void *data, size_t len, int retain)
+{
+    if (!mqtt_client || !mqtt_connected) {
+        return false;
+    }
+
+    portENTER_CRITICAL(&ack_lock);
+    tracked_msg_id = -1;
+    tracked_ack_us = -1;
+    tracked_pending = true;
+    early_acks = 0;
+    portEXIT_CRITICAL(&ack_lock);
+
+    int msg_id = esp_mqtt_client_publish(mqtt_client, topic, (const char *)data, len, 1, retain);
+
+    // From here on the event handler records the PUBACK directly
+    portENTER_CRITICAL(&ack_lock);
+    tracked_msg_id = msg_id;
+    tracked_pending = false;
+    for (int i = 0; i < early_acks; i++) {
+        if (early_ack_id[i] == msg_id) {
+            tracked_ack_us = early_ack_us[i];
+        }
+    }
+    portEXIT_CRITICAL(&ack_lock);
+    return (msg_id != -1);
+}
+
+int64_t mqtt_manager_wait_acked(int timeout_ms)
+{
+    if (tracked_msg_id == -1) {
+        return -1;
+    }
+    for (int waited_ms = 0; ; waited_ms += 10) {
+        if (tracked_ack_us >= 0) {
+            return tracked_ack_us;
+        }
+        if (waited_ms >= timeout_ms || !mqtt_connected || cycle_supervisor_expired()) {
+            return -1;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+}
+
+bool mqtt_manager_publish_data(const char *topic, const void *data, size_t len, int qos, int retain)
+{
+    if (!mqtt_client || !mqtt_connected) {
+        return false;
+    }
+
+    int msg_id = esp_mqtt_client_publish(mqtt_client, topic, (const char *)data, len, qos, retain);
+    return (msg_id != -1);
+}
+
+// Subscribe to every topic with one SUBSCRIBE and pass their retained
+// messages to the callbacks, waiting up to timeout_ms. Sets each fetch's len
+// (-1 if no complete message arrived); false if the subscription failed.
+static bool fetch_retained_topics(retained_fetch_t *fetches, int count, int timeout_ms)
+{
+    if (!mqtt_client || !mqtt_connected || count <= 0 || count > MQTT_RETAINED_MAX) {
+        return false;
+    }
+    if (!retained_lock) {
+        retained_lock = xSemaphoreCreateMutex();
+        if (!retained_lock) {
+            return false;
+        }
+    }
+
+    esp_mqtt_topic_t filters[MQTT_RETAINED_MAX];
+    for (int i = 0; i < count; i++) {
+        fetches[i].len = -1;
+        fetches[i].failed = false;
+        filters[i].filter = fetches[i].topic;
+        filters[i].qos = 1;
+    }
+
+    xSemaphoreTake(retained_lock, portMAX_DELAY);
+    retained_fetches = fetches;
+    retained_count = count;
+    retained_active = -1;
+    retained_receiving = false;
+    retained_subscribed = false;
+    retained_sub_msg_id = -1;
+    xSemaphoreGive(retained_lock);
+
+    retained_sub_msg_id = count == 1 ? esp_mqtt_client_subscribe(mqtt_client, fetches[0].topic, 1)
+                                     : esp_mqtt_client_subscribe_multiple(mqtt_client, filters, count);
+    if (retained_sub_msg_id == -1) {
+        xSemaphoreTake(retained_lock, portMAX_DELAY);
+        retained_count = 0;
+        xSemaphoreGive(retained_lock);
+        return false;
+    }
+
+    // The broker delivers retained messages right after the subscription; if
+    // nothing arrives shortly after the SUBACK there is no pending message.
+    // Once a message has started, wait for the rest of it.
+    int waited_ms = 0;
+    int grace_ms = 0;
+    int done = 0;
+    while (done < count && waited_ms < timeout_ms &&
+           (grace_ms < RETAINED_GRACE_MS || retained_receiving) && !cycle_supervisor_expired()) {
+        vTaskDelay(pdMS_TO_TICKS(20));
+        waited_ms += 20;
+        if (retained_subscribed) {
+            grace_ms += 20;
+        }
+        done = 0;
+        for (int i = 0; i < count; i++) {
+            done += fetches[i].len >= 0 || fetches[i].failed;
+        }
+    }
+
+    // Wait for a callback in progress before the caller's context goes away
+    xSemaphoreTake(retained_lock, portMAX_DELAY);
+    retained_count = 0;
+    retained_active = -1;
+    retained_receiving = false;
+    xSemaphoreGive(retained_lock);
+
+    for (int i = 0; i < count; i++) {
+        esp_mqtt_client_unsubscribe(mqtt_client, fetches[i].topic);
+        if (fetches[i].failed) {
+            fetches[i].len = -1;
+        }
+        if (fetches[i].len >= 0) {
+            BINLOG_D(MQTT, MQTT_RETAINED, fetches[i].len);
+        }
+    }
+    return true;
+}
+
+int mqtt_manager_stream_retained(const char *topic, mqtt_stream_cb_t cb, void *ctx, int timeout_ms)
+{
+    retained_fetch_t fetch = { .topic = topic, .cb = cb, .ctx = ctx };
+    return fetch_retained_topics(&fetch, 1, timeout_ms) ? fetch.len : -1;
+}
+
+typedef struct {
+    char *buf;
+    size_t buf_len;
+} retained_copy_t;
+
+// Copy as much of the message as fits, NUL-terminated
+static bool copy_retained(void *ctx, const uint8_t *data, size_t len, size_t offset, size_t total)
+{
+    retained_copy_t *copy = ctx;
+    size_t limit = copy->buf_len - 1;
+    if (offset < limit) {
+        size_t n = (len < limit - offset) ? len : limit - offset;
+        memcpy(copy->buf + offset, data, n);
+    }
+    copy->buf[total < limit ? total : limit] = '\0';
+    return true;
+}
+
+void mqtt_manager_fetch_requests(mqtt_request_t *requests, int count, int timeout_ms)
+{
+    retained_fetch_t fetches[MQTT_RETAINED_MAX];
+    retained_copy_t copies[MQTT_RETAINED_MAX];
+
+    if (count > MQTT_RETAINED_MAX) {
+        count = MQTT_RETAINED_MAX;
+    }
+    for (int i = 0; i < count; i++) {
+        requests[i].len = -1;
+        requests[i].buf[0] = '\0';
+        copies[i] = (retained_copy_t){ .buf = requests[i].buf, .buf_len = requests[i].buf_len };
+        fetches[i] = (retained_fetch_t){ .topic = requests[i].topic, .cb = copy_retained, .ctx = &copies[i] };
+    }
+    if (!fetch_retained_topics(fetches, count, timeout_ms)) {
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        int len = fetches[i].len;
+        requests[i].len = (len >= (int)requests[i].buf_len) ? (int)requests[i].buf_len - 1 : len;
+    }
+}
+
 void mqtt_manager_cleanup(void)
 {
     if (mqtt_client) {
@@ -110,4 +401,6 @@ void mqtt_manager_cleanup(void)
         mqtt_client = NULL;
     }
     mqtt_connected = false;
+    tracked_msg_id = -1;
+    tracked_pending = false;
 }
\ No newline at end of file
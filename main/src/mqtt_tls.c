@@ -0,0 +1,390 @@
+#include "mqtt_tls.h"
+#include "binlog.h"
+#include "secrets.h"
+
+#if MQTT_USE_TLS
+
+#include "esp_timer.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/x509_crt.h"
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef MQTT_CA_CERT
+    #error "MQTT_USE_TLS requires the broker CA certificate (MQTT_CA_CERT) in secrets.h"
+#endif
+
+// Serialized session from the last successful handshake
+RTC_DATA_ATTR static uint8_t session_data[MQTT_TLS_SESSION_SIZE];
+RTC_DATA_ATTR static uint16_t session_len = 0;
+RTC_DATA_ATTR static mqtt_tls_stats_t stats = {0};
+
+typedef struct {
+    bool open;
+    bool full_handshake;    // Set by the verify callback (certificates only arrive in a full handshake)
+    mbedtls_net_context net;
+    mbedtls_ssl_context ssl;
+    mbedtls_ssl_config conf;
+    mbedtls_x509_crt ca;
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context drbg;
+} tls_context_t;
+
+// Wait until the socket is readable (or writable). Returns >0 when ready,
+// 0 on timeout and -1 on error, as the transport poll functions expect.
+static int wait_socket(int fd, bool write, int timeout_ms)
+{
+    fd_set fds, errfds;
+    FD_ZERO(&fds);
+    FD_ZERO(&errfds);
+    FD_SET(fd, &fds);
+    FD_SET(fd, &errfds);
+    struct timeval tv = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_usec = (timeout_ms % 1000) * 1000,
+    };
+
+    int ret = select(fd + 1, write ? NULL : &fds, write ? &fds : NULL, &errfds, &tv);
+    if (ret > 0 && FD_ISSET(fd, &errfds)) {
+        return -1;
+    }
+    return ret;
+}
+
+// Non-blocking TCP connect bounded by timeout_ms; returns the socket or -1
+static int tcp_connect(const char *host, int port, int timeout_ms)
+{
+    struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *res = NULL;
+    char port_str[8];
+    snprintf(port_str, sizeof(port_str), "%d", port);
+
+    if (getaddrinfo(host, port_str, &hints, &res) != 0 || !res) {
+        return -1;
+    }
+
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd >= 0) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        int ret = connect(fd, res->ai_addr, res->ai_addrlen);
+        if (ret < 0 && errno == EINPROGRESS && wait_socket(fd, true, timeout_ms) > 0) {
+            int err = 0;
+            socklen_t err_len = sizeof(err);
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+            ret = err ? -1 : 0;
+        }
+        if (ret < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+static int verify_callback(void *arg, mbedtls_x509_crt *crt, int depth, uint32_t *flags)
+{
+    // Only note that a certificate chain was received; mbedtls still
+    // applies the CA check through the flags
+    ((tls_context_t *)arg)->full_handshake = true;
+    return 0;
+}
+
+static void tls_free(tls_context_t *ctx)
+{
+    mbedtls_ssl_free(&ctx->ssl);
+    mbedtls_ssl_config_free(&ctx->conf);
+    mbedtls_x509_crt_free(&ctx->ca);
+    mbedtls_ctr_drbg_free(&ctx->drbg);
+    mbedtls_entropy_free(&ctx->entropy);
+    mbedtls_net_free(&ctx->net);  // Closes the socket
+    ctx->open = false;
+}
+
+static void tls_init(tls_context_t *ctx)
+{
+    mbedtls_net_init(&ctx->net);
+    mbedtls_ssl_init(&ctx->ssl);
+    mbedtls_ssl_config_init(&ctx->conf);
+    mbedtls_x509_crt_init(&ctx->ca);
+    mbedtls_ctr_drbg_init(&ctx->drbg);
+    mbedtls_entropy_init(&ctx->entropy);
+    ctx->open = true;
+    ctx->full_handshake = false;
+}
+
+static int tls_setup(tls_context_t *ctx, const char *host)
+{
+    int ret;
+
+    // The certificate must match MQTT_TLS_COMMON_NAME if set, otherwise the broker address
+#ifdef MQTT_TLS_COMMON_NAME
+    const char *common_name = MQTT_TLS_COMMON_NAME;
+#else
+    const char *common_name = host;
+#endif
+
+    if ((ret = mbedtls_ctr_drbg_seed(&ctx->drbg, mbedtls_entropy_func, &ctx->entropy, NULL, 0)) != 0 ||
+        (ret = mbedtls_x509_crt_parse(&ctx->ca, (const unsigned char *)MQTT_CA_CERT,
+                                      sizeof(MQTT_CA_CERT))) != 0 ||
+        (ret = mbedtls_ssl_config_defaults(&ctx->conf, MBEDTLS_SSL_IS_CLIENT,
+                                           MBEDTLS_SSL_TRANSPORT_STREAM,
+                                           MBEDTLS_SSL_PRESET_DEFAULT)) != 0) {
+        return ret;
+    }
+
+    mbedtls_ssl_conf_authmode(&ctx->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_ca_chain(&ctx->conf, &ctx->ca, NULL);
+    mbedtls_ssl_conf_rng(&ctx->conf, mbedtls_ctr_drbg_random, &ctx->drbg);
+    mbedtls_ssl_conf_verify(&ctx->conf, verify_callback, ctx);
+    // Resumption relies on TLS 1.2 session IDs and tickets
+    mbedtls_ssl_conf_max_tls_version(&ctx->conf, MBEDTLS_SSL_VERSION_TLS1_2);
+#ifdef MBEDTLS_SSL_SESSION_TICKETS
+    mbedtls_ssl_conf_session_tickets(&ctx->conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+
+    if ((ret = mbedtls_ssl_setup(&ctx->ssl, &ctx->conf)) != 0 ||
+        (ret = mbedtls_ssl_set_hostname(&ctx->ssl, common_name)) != 0) {
+        return ret;
+    }
+    mbedtls_ssl_set_bio(&ctx->ssl, &ctx->net, mbedtls_net_send, mbedtls_net_recv, NULL);
+    return 0;
+}
+
+// Offer the cached session, if any; returns true if one was set
+static bool tls_offer_session(tls_context_t *ctx)
+{
+    if (session_len == 0) {
+        return false;
+    }
+
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    bool offered = mbedtls_ssl_session_load(&session, session_data, session_len) == 0 &&
+                   mbedtls_ssl_set_session(&ctx->ssl, &session) == 0;
+    mbedtls_ssl_session_free(&session);
+
+    if (!offered) {
+        session_len = 0;
+    }
+    return offered;
+}
+
+// Serialize the negotiated session into RTC memory for the next wake
+static void tls_save_session(tls_context_t *ctx)
+{
+    mbedtls_ssl_session session;
+    size_t len = 0;
+    mbedtls_ssl_session_init(&session);
+
+    if (mbedtls_ssl_get_session(&ctx->ssl, &session) == 0 &&
+        mbedtls_ssl_session_save(&session, session_data, sizeof(session_data), &len) == 0) {
+        session_len = len;
+    } else {
+        session_len = 0;
+        BINLOG_W(TLS, TLS_SESSION_NOT_SAVED, (int)len, MQTT_TLS_SESSION_SIZE);
+    }
+    mbedtls_ssl_session_free(&session);
+}
+
+static int tls_handshake(tls_context_t *ctx, int timeout_ms)
+{
+    int64_t deadline = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+    int ret;
+
+    while ((ret = mbedtls_ssl_handshake(&ctx->ssl)) != 0) {
+        int remaining_ms = (int)((deadline - esp_timer_get_time()) / 1000);
+        if (remaining_ms <= 0) {
+            return MBEDTLS_ERR_SSL_TIMEOUT;
+        }
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            if (wait_socket(ctx->net.fd, ret == MBEDTLS_ERR_SSL_WANT_WRITE, remaining_ms) < 0) {
+                return ret;
+            }
+        } else {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+static int tls_connect(esp_transport_handle_t t, const char *host, int port, int timeout_ms)
+{
+    tls_context_t *ctx = esp_transport_get_context_data(t);
+    if (ctx->open) {
+        tls_free(ctx);
+    }
+
+    tls_init(ctx);
+    ctx->net.fd = tcp_connect(host, port, timeout_ms);
+    if (ctx->net.fd < 0) {
+        BINLOG_E(TLS, TLS_CONNECT_FAILED, port);
+        tls_free(ctx);
+        return -1;
+    }
+
+    int ret = tls_setup(ctx, host);
+    if (ret != 0) {
+        BINLOG_E(TLS, TLS_SETUP_FAILED, -ret);
+        tls_free(ctx);
+        return -1;
+    }
+
+    bool offered = tls_offer_session(ctx);
+    int64_t start = esp_timer_get_time();
+    ret = tls_handshake(ctx, timeout_ms);
+    uint32_t elapsed_ms = (uint32_t)((esp_timer_get_time() - start) / 1000);
+
+    if (ret != 0) {
+        BINLOG_E(TLS, TLS_HANDSHAKE_FAILED, -ret, offered);
+        stats.failed++;
+        // Do not offer a session that may have caused the failure again
+        session_len = 0;
+        tls_free(ctx);
+        return -1;
+    }
+
+    bool resumed = offered && !ctx->full_handshake;
+    stats.last_resumed = resumed;
+    stats.last_ms = elapsed_ms;
+    if (resumed) {
+        stats.resumed++;
+        stats.last_resumed_ms = elapsed_ms;
+    } else {
+        stats.full++;
+        stats.last_full_ms = elapsed_ms;
+    }
+    BINLOG_I(TLS, TLS_HANDSHAKE, (int)elapsed_ms, resumed);
+
+    tls_save_session(ctx);
+    return 0;
+}
+
+static int tls_poll_read(esp_transport_handle_t t, int timeout_ms)
+{
+    tls_context_t *ctx = esp_transport_get_context_data(t);
+    if (!ctx->open) {
+        return -1;
+    }
+    if (mbedtls_ssl_get_bytes_avail(&ctx->ssl) > 0) {
+        return 1;
+    }
+    return wait_socket(ctx->net.fd, false, timeout_ms);
+}
+
+static int tls_poll_write(esp_transport_handle_t t, int timeout_ms)
+{
+    tls_context_t *ctx = esp_transport_get_context_data(t);
+    if (!ctx->open) {
+        return -1;
+    }
+    return wait_socket(ctx->net.fd, true, timeout_ms);
+}
+
+static int tls_read(esp_transport_handle_t t, char *buffer, int len, int timeout_ms)
+{
+    tls_context_t *ctx = esp_transport_get_context_data(t);
+    int poll = tls_poll_read(t, timeout_ms);
+    if (poll < 0) {
+        return ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+    }
+    if (poll == 0) {
+        return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+    }
+
+    int ret = mbedtls_ssl_read(&ctx->ssl, (unsigned char *)buffer, len);
+    if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+        return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+    }
+    if (ret == 0 || ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+        return ERR_TCP_TRANSPORT_CONNECTION_CLOSED_BY_FIN;
+    }
+    return ret < 0 ? ERR_TCP_TRANSPORT_CONNECTION_FAILED : ret;
+}
+
+static int tls_write(esp_transport_handle_t t, const char *buffer, int len, int timeout_ms)
+{
+    tls_context_t *ctx = esp_transport_get_context_data(t);
+    int poll = tls_poll_write(t, timeout_ms);
+    if (poll <= 0) {
+        return poll;
+    }
+
+    int ret = mbedtls_ssl_write(&ctx->ssl, (const unsigned char *)buffer, len);
+    if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+        return 0;
+    }
+    return ret < 0 ? -1 : ret;
+}
+
+static int tls_close(esp_transport_handle_t t)
+{
+    tls_context_t *ctx = esp_transport_get_context_data(t);
+    if (ctx->open) {
+        mbedtls_ssl_close_notify(&ctx->ssl);
+        tls_free(ctx);
+    }
+    return 0;
+}
+
+static int tls_destroy(esp_transport_handle_t t)
+{
+    tls_close(t);
+    free(esp_transport_get_context_data(t));
+    return 0;
+}
+
+esp_transport_handle_t mqtt_tls_transport_create(void)
+{
+    tls_context_t *ctx = calloc(1, sizeof(tls_context_t));
+    esp_transport_handle_t t = ctx ? esp_transport_init() : NULL;
+    if (!t) {
+        free(ctx);
+        return NULL;
+    }
+
+    esp_transport_set_context_data(t, ctx);
+    esp_transport_set_func(t, tls_connect, tls_read, tls_write, tls_close,
+                           tls_poll_read, tls_poll_write, tls_destroy);
+    esp_transport_set_default_port(t, MQTT_PORT);
+    return t;
+}
+
+void mqtt_tls_forget_session(void)
+{
+    session_len = 0;
+}
+
+const mqtt_tls_stats_t *mqtt_tls_stats(void)
+{
+    return &stats;
+}
+
+#else // !MQTT_USE_TLS
+
+esp_transport_handle_t mqtt_tls_transport_create(void)
+{
+    return NULL;
+}
+
+void mqtt_tls_forget_session(void)
+{
+}
+
+const mqtt_tls_stats_t *mqtt_tls_stats(void)
+{
+    static const mqtt_tls_stats_t stats = {0};
+    return &stats;
+}
+
+#endif // MQTT_USE_TLS
@@ -0,0 +1,403 @@
+#include "ota_manager.h"
+#include "delta_patch.h"
+#include "mqtt_manager.h"
+#include "device_config.h"
+#include "cycle_supervisor.h"
+#include "binlog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_app_desc.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_http_client.h"
+#include "esp_timer.h"
+#include "mbedtls/sha256.h"
+#include "rom/miniz.h"
+
+const char *ota_manager_running_version(void)
+{
+    return esp_app_get_description()->version;
+}
+
+#if OTA_ENABLE
+
+typedef enum {
+    OTA_ERR_NONE,
+    OTA_ERR_FORMAT,     // Not a delta
+    OTA_ERR_SOURCE,     // Delta made against another image
+    OTA_ERR_DOWNLOAD,   // Transfer failed or incomplete
+    OTA_ERR_PATCH,      // Corrupt op stream
+    OTA_ERR_VERIFY,     // Rebuilt image does not match
+    OTA_ERR_FLASH,      // OTA partition write failed
+    OTA_ERR_MEMORY,
+} ota_error_t;
+
+static const char *error_names[] = {
+    [OTA_ERR_NONE] = "none",
+    [OTA_ERR_FORMAT] = "format",
+    [OTA_ERR_SOURCE] = "source_mismatch",
+    [OTA_ERR_DOWNLOAD] = "download",
+    [OTA_ERR_PATCH] = "patch",
+    [OTA_ERR_VERIFY] = "verify",
+    [OTA_ERR_FLASH] = "flash",
+    [OTA_ERR_MEMORY] = "memory",
+};
+
+// Last version that failed to install, so it is not downloaded again on every
+// heartbeat (until the device is power cycled, another version is requested
+// or the request is cleared)
+RTC_DATA_ATTR static char failed_version[32];
+
+// A version the bootloader rolled back is skipped while its request stays as
+// it was when the device first saw it after the rollback. A rollback may only
+// have been a network outage, so clearing the request or publishing a
+// different one (e.g. another URL) re-arms it.
+#define REQUEST_NONE 0          // No request seen since power-up
+#define REQUEST_CLEARED 1       // Request cleared since the rollback
+RTC_DATA_ATTR static uint32_t rolled_back_request = REQUEST_NONE;
+
+// FNV-1a hash of the request text, never one of the values above
+static uint32_t request_hash(const char *request)
+{
+    uint32_t hash = 2166136261u;
+    while (*request) {
+        hash = (hash ^ (uint8_t)*request++) * 16777619u;
+    }
+    return hash > REQUEST_CLEARED ? hash : REQUEST_CLEARED + 1;
+}
+
+typedef struct {
+    delta_header_t header;
+    size_t header_len;
+    const esp_partition_t *source;
+    const esp_partition_t *target;
+    esp_ota_handle_t handle;
+    bool started;                   // esp_ota_begin succeeded
+    bool inflate_done;
+    int error;                      // ota_error_t, sticky
+    uint32_t received;
+    delta_patch_t patch;
+    mbedtls_sha256_context sha;
+    tinfl_decompressor inflator;
+    size_t dict_ofs;
+    uint8_t dict[TINFL_LZ_DICT_SIZE]; // Inflate window, also the patch input
+    uint8_t rx_buf[1024];
+} ota_session_t;
+
+static void publish_status(const char *state, const char *version, const char *detail)
+{
+    char status[96];
+    snprintf(status, sizeof(status), "%s %s%s%s", state, version,
+             detail ? " " : "", detail ? detail : "");
+    mqtt_manager_publish(device_config_topic(DEVICE_TOPIC_OTA_STATUS), status, 1, 1);
+}
+
+static int read_source(void *ctx, uint32_t offset, uint8_t *buf, size_t len)
+{
+    ota_session_t *s = ctx;
+    return esp_partition_read(s->source, offset, buf, len) == ESP_OK ? 0 : -1;
+}
+
+static int write_target(void *ctx, const uint8_t *data, size_t len)
+{
+    ota_session_t *s = ctx;
+    mbedtls_sha256_update(&s->sha, data, len);
+    return esp_ota_write(s->handle, data, len) == ESP_OK ? 0 : -1;
+}
+
+// Header received: check it applies to the running image and start writing
+static int begin_update(ota_session_t *s)
+{
+    if (delta_header_check(&s->header) != 0) {
+        return OTA_ERR_FORMAT;
+    }
+    if (memcmp(s->header.source_id, esp_app_get_description()->app_elf_sha256, 32) != 0 ||
+        s->header.source_size > s->source->size) {
+        BINLOG_E(OTA, OTA_SOURCE_MISMATCH);
+        return OTA_ERR_SOURCE;
+    }
+    if (s->header.target_size > s->target->size) {
+        BINLOG_E(OTA, OTA_FLASH_FAILED, ESP_ERR_INVALID_SIZE);
+        return OTA_ERR_FLASH;
+    }
+
+    // Sequential writes erase as they go, instead of the whole slot up front
+    esp_err_t err = esp_ota_begin(s->target, OTA_WITH_SEQUENTIAL_WRITES, &s->handle);
+    if (err != ESP_OK) {
+        BINLOG_E(OTA, OTA_FLASH_FAILED, err);
+        return OTA_ERR_FLASH;
+    }
+    s->started = true;
+
+    BINLOG_I(OTA, OTA_DELTA, s->header.target_size, s->header.source_size, s->header.flags);
+    tinfl_init(&s->inflator);
+    mbedtls_sha256_starts(&s->sha, 0);
+    delta_patch_init(&s->patch, s->header.source_size, s->header.target_size,
+                     read_source, write_target, s);
+    return OTA_ERR_NONE;
+}
+
+// Apply the next piece of the download; false once the update has failed
+static bool ota_feed(ota_session_t *s, const uint8_t *data, size_t len)
+{
+    if (s->error) {
+        return false;
+    }
+    s->received += len;
+
+    if (s->header_len < sizeof(s->header)) {
+        size_t n = sizeof(s->header) - s->header_len;
+        if (n > len) n = len;
+        memcpy((uint8_t *)&s->header + s->header_len, data, n);
+        s->header_len += n;
+        data += n;
+        len -= n;
+        if (s->header_len < sizeof(s->header)) {
+            return true;
+        }
+        s->error = begin_update(s);
+        if (s->error) {
+            return false;
+        }
+    }
+
+    int rc = DELTA_OK;
+    if (!(s->header.flags & DELTA_FLAG_ZLIB)) {
+        rc = delta_patch_feed(&s->patch, data, len);
+    } else {
+        // Inflate into the circular window and patch from it in place
+        while (rc >= DELTA_OK && !s->inflate_done) {
+            size_t in_bytes = len;
+            size_t out_bytes = TINFL_LZ_DICT_SIZE - s->dict_ofs;
+            tinfl_status status = tinfl_decompress(&s->inflator, data, &in_bytes, s->dict,
+                                                   s->dict + s->dict_ofs, &out_bytes,
+                                                   TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT);
+            data += in_bytes;
+            len -= in_bytes;
+            if (out_bytes > 0) {
+                rc = delta_patch_feed(&s->patch, s->dict + s->dict_ofs, out_bytes);
+                s->dict_ofs = (s->dict_ofs + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+            }
+            if (status == TINFL_STATUS_DONE) {
+                s->inflate_done = true;
+            } else if (status < 0) {
+                rc = DELTA_ERR_OP;
+            } else if (status == TINFL_STATUS_NEEDS_MORE_INPUT) {
+                break;
+            }
+        }
+        if (s->inflate_done && len > 0) {
+            rc = DELTA_ERR_OP;
+        }
+    }
+
+    if (rc < 0) {
+        BINLOG_E(OTA, OTA_PATCH_FAILED, rc, s->patch.written);
+        s->error = (rc == DELTA_ERR_WRITE) ? OTA_ERR_FLASH : OTA_ERR_PATCH;
+        return false;
+    }
+    return true;
+}
+
+static bool stream_delta(void *ctx, const uint8_t *data, size_t len, size_t offset, size_t total)
+{
+    return ota_feed(ctx, data, len);
+}
+
+static int download_mqtt(ota_session_t *s)
+{
+    int len = mqtt_manager_stream_retained(device_config_topic(DEVICE_TOPIC_OTA_DELTA),
+                                           stream_delta, s, cycle_supervisor_remaining_ms());
+    if (s->error) {
+        return s->error;
+    }
+    return (len > 0) ? OTA_ERR_NONE : OTA_ERR_DOWNLOAD;
+}
+
+static int download_http(ota_session_t *s, const char *url)
+{
+    esp_http_client_config_t config = {
+        .url = url,
+        .timeout_ms = OTA_HTTP_TIMEOUT_MS,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (!client) {
+        return OTA_ERR_MEMORY;
+    }
+
+    int result = OTA_ERR_DOWNLOAD;
+    int status = 0;
+    esp_err_t err = esp_http_client_open(client, 0);
+    if (err == ESP_OK) {
+        esp_http_client_fetch_headers(client);
+        status = esp_http_client_get_status_code(client);
+    }
+    if (err != ESP_OK || status != 200) {
+        BINLOG_E(OTA, OTA_HTTP_FAILED, err, status);
+    } else {
+        int n;
+        while ((n = esp_http_client_read(client, (char *)s->rx_buf, sizeof(s->rx_buf))) > 0 &&
+               ota_feed(s, s->rx_buf, n) && !cycle_supervisor_expired()) {
+        }
+        if (n == 0 && esp_http_client_is_complete_data_received(client)) {
+            result = OTA_ERR_NONE;
+        }
+    }
+
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+    return s->error ? s->error : result;
+}
+
+// Download complete: verify the rebuilt image and make it the boot image
+static int finish_update(ota_session_t *s)
+{
+    if (!s->started || s->patch.result != DELTA_DONE || s->patch.written != s->header.target_size) {
+        return OTA_ERR_DOWNLOAD;
+    }
+
+    uint8_t digest[32];
+    mbedtls_sha256_finish(&s->sha, digest);
+    if (memcmp(digest, s->header.target_sha256, sizeof(digest)) != 0) {
+        return OTA_ERR_VERIFY;
+    }
+
+    // esp_ota_end also validates the image structure and its own checksum
+    esp_err_t err = esp_ota_end(s->handle);
+    s->started = false;
+    if (err != ESP_OK) {
+        BINLOG_E(OTA, OTA_FLASH_FAILED, err);
+        return OTA_ERR_VERIFY;
+    }
+    err = esp_ota_set_boot_partition(s->target);
+    if (err != ESP_OK) {
+        BINLOG_E(OTA, OTA_FLASH_FAILED, err);
+        return OTA_ERR_FLASH;
+    }
+    return OTA_ERR_NONE;
+}
+
+bool ota_manager_check(const char *request)
+{
+    char version[sizeof(failed_version)];
+    char source[160];
+
+    if (!request || request[0] == '\0') {
+        // No request (any more): earlier failures may be retried
+        failed_version[0] = '\0';
+        if (rolled_back_request != REQUEST_NONE) {
+            rolled_back_request = REQUEST_CLEARED;
+        }
+        return false;
+    }
+    if (sscanf(request, "%31s %159s", version, source) != 2) {
+        BINLOG_W(OTA, OTA_BAD_REQUEST);
+        return false;
+    }
+    if (strcmp(version, ota_manager_running_version()) == 0 ||
+        strcmp(version, failed_version) == 0) {
+        return false;
+    }
+
+    // An update that was installed but failed its first boot is retried only
+    // once the request has been cleared or changed since the rollback
+    const esp_partition_t *invalid = esp_ota_get_last_invalid_partition();
+    esp_app_desc_t invalid_desc;
+    if (invalid && esp_ota_get_partition_description(invalid, &invalid_desc) == ESP_OK &&
+        strcmp(invalid_desc.version, version) == 0) {
+        uint32_t hash = request_hash(request);
+        if (rolled_back_request == REQUEST_NONE) {
+            BINLOG_W(OTA, OTA_ROLLED_BACK);
+            rolled_back_request = hash;
+            publish_status("rolled_back", version, NULL);
+            return false;
+        }
+        if (rolled_back_request == hash) {
+            return false;
+        }
+        BINLOG_I(OTA, OTA_REARMED);
+    }
+    rolled_back_request = REQUEST_NONE;
+
+    bool use_mqtt = strcmp(source, "mqtt") == 0;
+    BINLOG_I(OTA, OTA_REQUEST, use_mqtt);
+    cycle_supervisor_extend(CYCLE_BUDGET_OTA_MS);
+    cycle_supervisor_set_phase(CYCLE_PHASE_OTA);
+    int64_t start_us = esp_timer_get_time();
+
+    // Large buffers (inflate window and state), so allocate only when needed
+    int error = OTA_ERR_MEMORY;
+    ota_session_t *s = calloc(1, sizeof(*s));
+    if (s) {
+        mbedtls_sha256_init(&s->sha);
+        s->source = esp_ota_get_running_partition();
+        s->target = esp_ota_get_next_update_partition(NULL);
+        if (!s->target) {
+            error = OTA_ERR_FLASH;
+        } else {
+            publish_status("downloading", version, NULL);
+            error = use_mqtt ? download_mqtt(s) : download_http(s, source);
+            if (error == OTA_ERR_NONE) {
+                error = finish_update(s);
+            }
+        }
+        if (s->started) {
+            esp_ota_abort(s->handle);
+        }
+        mbedtls_sha256_free(&s->sha);
+        BINLOG_I(OTA, OTA_RESULT, error, s->received,
+                 (int)((esp_timer_get_time() - start_us) / 1000));
+        free(s);
+    }
+    cycle_supervisor_set_phase(CYCLE_PHASE_PUBLISH);
+
+    if (error != OTA_ERR_NONE) {
+        snprintf(failed_version, sizeof(failed_version), "%s", version);
+        publish_status("failed", version, error_names[error]);
+        return false;
+    }
+    publish_status("installed", version, NULL);
+    return true;
+}
+
+bool ota_manager_pending_verify(void)
+{
+    esp_ota_img_states_t state;
+    return esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) == ESP_OK &&
+           state == ESP_OTA_IMG_PENDING_VERIFY;
+}
+
+void ota_manager_confirm(bool published)
+{
+    if (!ota_manager_pending_verify()) {
+        return;
+    }
+
+    if (published) {
+        esp_ota_mark_app_valid_cancel_rollback();
+        BINLOG_I(OTA, OTA_CONFIRMED);
+        publish_status("running", ota_manager_running_version(), NULL);
+    } else {
+        BINLOG_E(OTA, OTA_ROLLBACK);
+        esp_ota_mark_app_invalid_rollback_and_reboot();
+    }
+}
+
+#else
+
+bool ota_manager_check(const char *request)
+{
+    return false;
+}
+
+bool ota_manager_pending_verify(void)
+{
+    return false;
+}
+
+void ota_manager_confirm(bool published)
+{
+}
+
+#endif
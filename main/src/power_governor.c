@@ -0,0 +1,178 @@
+#include "power_governor.h"
+#include "binlog.h"
+#include "sensor_classify.h"
+#include "esp_adc/adc_cali_scheme.h"
+
+typedef struct {
+    uint8_t heartbeat_scale;    // Heartbeat interval multiplier
+    uint8_t burst_percent;      // Of BURST_DURATION_MS
+    uint8_t retry_percent;      // Of each connection wait loop
+    bool optional;              // Trace/log uploads and OTA checks
+} power_stage_params_t;
+
+static const power_stage_params_t stage_params[POWER_STAGE_COUNT] = {
+    [POWER_STAGE_NORMAL] = {1, 100, 100, true},
+    [POWER_STAGE_CONSERVE] = {2, 75, 75, true},
+    [POWER_STAGE_LOW] = {4, 50, 50, false},
+    [POWER_STAGE_CRITICAL] = {8, 25, 34, false},
+};
+
+static const char *stage_names[POWER_STAGE_COUNT] = {
+    [POWER_STAGE_NORMAL] = "normal",
+    [POWER_STAGE_CONSERVE] = "conserve",
+    [POWER_STAGE_LOW] = "low",
+    [POWER_STAGE_CRITICAL] = "critical",
+};
+
+// Filtered voltage below which each stage starts
+static const int stage_threshold_mv[POWER_STAGE_COUNT] = {
+    [POWER_STAGE_NORMAL] = 0,
+    [POWER_STAGE_CONSERVE] = SUPPLY_CONSERVE_MV,
+    [POWER_STAGE_LOW] = SUPPLY_LOW_MV,
+    [POWER_STAGE_CRITICAL] = SUPPLY_CRITICAL_MV,
+};
+
+// Filtered supply voltage in mV x16, 0 until the first reading after power-up
+RTC_DATA_ATTR static uint32_t filtered_mv_x16 = 0;
+RTC_DATA_ATTR static uint8_t stage = POWER_STAGE_NORMAL;
+
+static int supply_mv = 0;
+
+// Approximate full scale of the ESP32-C3 ADC at 12 dB attenuation, used
+// without eFuse calibration
+#define UNCALIBRATED_FULL_SCALE_MV 2500
+
+// Pin voltage in mV; *calibrated is cleared if any sample had to be converted
+// without the eFuse calibration
+static int read_pin_mv(adc_oneshot_unit_handle_t adc1_handle, bool *calibrated)
+{
+    adc_cali_handle_t cali = NULL;
+#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
+    const adc_cali_curve_fitting_config_t cali_config = {
+        .unit_id = ADC_UNIT_1,
+        .chan = SUPPLY_ADC_CHANNEL,
+        .atten = ADC_ATTEN_DB_12,
+        .bitwidth = ADC_BITWIDTH_DEFAULT,
+    };
+    if (adc_cali_create_scheme_curve_fitting(&cali_config, &cali) != ESP_OK) {
+        cali = NULL;
+    }
+#endif
+
+    int sum = 0;
+    int count = 0;
+    *calibrated = true;
+    for (int i = 0; i < SUPPLY_SAMPLES; i++) {
+        int raw;
+        int mv;
+        if (adc_oneshot_read(adc1_handle, SUPPLY_ADC_CHANNEL, &raw) != ESP_OK) {
+            continue;
+        }
+        if (!cali || adc_cali_raw_to_voltage(cali, raw, &mv) != ESP_OK) {
+            mv = raw * UNCALIBRATED_FULL_SCALE_MV / SENSOR_ADC_MAX;
+            *calibrated = false;
+        }
+        sum += mv;
+        count++;
+    }
+
+#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
+    if (cali) {
+        adc_cali_delete_scheme_curve_fitting(cali);
+    }
+#endif
+    return count ? sum / count : 0;
+}
+
+void power_governor_update(adc_oneshot_unit_handle_t adc1_handle)
+{
+#if SUPPLY_MONITOR_ENABLE
+    const adc_oneshot_chan_cfg_t config = {
+        .atten = ADC_ATTEN_DB_12,
+        .bitwidth = ADC_BITWIDTH_DEFAULT,
+    };
+    esp_err_t ret = adc_oneshot_config_channel(adc1_handle, SUPPLY_ADC_CHANNEL, &config);
+    bool calibrated = false;
+    int pin_mv = ret == ESP_OK ? read_pin_mv(adc1_handle, &calibrated) : 0;
+    if (pin_mv <= 0) {
+        // Keep the previous stage rather than acting on a bad reading
+        BINLOG_W(POWER, SUPPLY_READ_FAILED, ret);
+        return;
+    }
+    supply_mv = pin_mv * SUPPLY_DIVIDER_RATIO_X1000 / 1000;
+
+    // An uncalibrated reading can be off by more than the gap between two
+    // thresholds, so it is reported but does not move the stage
+    if (!calibrated) {
+        BINLOG_W(POWER, SUPPLY_UNCALIBRATED, supply_mv);
+        return;
+    }
+
+    // Exponential moving average across wakes, so a single reading taken
+    // while the battery recovers or sags does not move the stage
+    if (filtered_mv_x16 == 0) {
+        filtered_mv_x16 = supply_mv << 4;
+    } else {
+        filtered_mv_x16 += ((int32_t)(supply_mv << 4) - (int32_t)filtered_mv_x16) >> SUPPLY_FILTER_SHIFT;
+    }
+    int filtered = power_governor_filtered_mv();
+
+    power_stage_t previous = stage;
+    while (stage < POWER_STAGE_CRITICAL && filtered < stage_threshold_mv[stage + 1]) {
+        stage++;
+    }
+    while (stage > POWER_STAGE_NORMAL && filtered >= stage_threshold_mv[stage] + SUPPLY_HYSTERESIS_MV) {
+        stage--;
+    }
+
+    BINLOG_D(POWER, SUPPLY_READING, supply_mv, filtered, stage);
+    if (stage != previous) {
+        BINLOG_W(POWER, POWER_STAGE, previous, stage, filtered);
+    }
+#endif
+}
+
+power_stage_t power_governor_stage(void)
+{
+    return stage < POWER_STAGE_COUNT ? stage : POWER_STAGE_NORMAL;
+}
+
+const char *power_governor_stage_name(power_stage_t s)
+{
+    return s < POWER_STAGE_COUNT ? stage_names[s] : "unknown";
+}
+
+int power_governor_supply_mv(void)
+{
+    return supply_mv;
+}
+
+int power_governor_filtered_mv(void)
+{
+    return (int)((filtered_mv_x16 + 8) >> 4);
+}
+
+int power_governor_heartbeat_scale(void)
+{
+    return stage_params[power_governor_stage()].heartbeat_scale;
+}
+
+int power_governor_burst_ms(void)
+{
+    int burst_ms = BURST_DURATION_MS * stage_params[power_governor_stage()].burst_percent / 100;
+    if (burst_ms < POWER_MIN_BURST_MS) {
+        burst_ms = POWER_MIN_BURST_MS < BURST_DURATION_MS ? POWER_MIN_BURST_MS : BURST_DURATION_MS;
+    }
+    return burst_ms;
+}
+
+int power_governor_retries(int max_retries)
+{
+    int retries = max_retries * stage_params[power_governor_stage()].retry_percent / 100;
+    return retries > 0 ? retries : 1;
+}
+
+bool power_governor_allow_optional(void)
+{
+    return stage_params[power_governor_stage()].optional;
+}
@@ -0,0 +1,21 @@
+#include "publish_policy.h"
+
+publish_decision_t publish_policy_decide(const publish_context_t *ctx, const bool *state,
+                                         const bool *last_state, int count)
+{
+    publish_decision_t decision = {0};
+
+    // Publish every sensor on first boot, heartbeat, or when the heartbeat interval is reached
+    decision.heartbeat = ctx->heartbeat_due || ctx->cycles_since_publish >= ctx->cycles_for_publish;
+    decision.publish_all = ctx->first_boot || decision.heartbeat;
+
+    for (int i = 0; i < count; i++) {
+        if (state[i] != last_state[i] || decision.publish_all) {
+            decision.publish_mask |= 1u << i;
+        }
+    }
+
+    // Connect and publish if any state changed or a full publish is due
+    decision.connect = decision.publish_mask != 0 || decision.publish_all;
+    return decision;
+}
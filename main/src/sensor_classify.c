@@ -0,0 +1,18 @@
+#include "sensor_classify.h"
+
+void sensor_data_reset(sensor_data_t *data)
+{
+    data->max_value = 0;
+    data->min_value = SENSOR_ADC_MAX;
+}
+
+void sensor_data_add_sample(sensor_data_t *data, int reading)
+{
+    if (reading > data->max_value) data->max_value = reading;
+    if (reading < data->min_value) data->min_value = reading;
+}
+
+bool sensor_data_above_threshold(const sensor_data_t *data, int threshold)
+{
+    return (data->max_value > threshold);
+}
@@ -1,11 +1,119 @@
 #include "sensor_manager.h"
+#include "binlog.h"
+#include "cycle_supervisor.h"
+#include "device_config.h"
+#include "power_governor.h"
 #include "config.h"
 #include <stdio.h>
+#include <string.h>
 #include "esp_timer.h"
 #include "esp_sleep.h"
+#include "driver/gpio.h"
 
 static const char *TAG = "sensor_manager";
 
+// Compiled-in sensor table; provisioned thresholds and topics are applied
+// in sensor_manager_init
+static sensor_config_t sensor_table[] = {
+    SENSOR_TABLE
+};
+
+#define SENSOR_COUNT ((int)(sizeof(sensor_table) / sizeof(sensor_table[0])))
+
+_Static_assert(SENSOR_COUNT <= SENSOR_MAX_CHANNELS, "SENSOR_TABLE has too many entries");
+
+// Encoded burst records, oldest first, kept across deep sleep
+RTC_DATA_ATTR static uint8_t trace_store[TRACE_BUFFER_SIZE];
+RTC_DATA_ATTR static uint16_t trace_store_len = 0;
+RTC_DATA_ATTR static uint8_t trace_store_records = 0;
+RTC_DATA_ATTR static uint16_t trace_burst_seq = 0;
+
+// Record being built during the current burst
+static uint8_t trace_work[TRACE_BUFFER_SIZE];
+static trace_encoder_t trace_encoder;
+static int trace_window[TRACE_CODEC_MAX_CHANNELS];
+static int trace_window_count = 0;
+
+static void trace_begin(uint8_t channel_mask)
+{
+    trace_encoder_begin(&trace_encoder, trace_work, sizeof(trace_work), trace_burst_seq++,
+                        channel_mask, TRACE_DECIMATION, SAMPLE_INTERVAL_MS);
+    trace_window_count = 0;
+}
+
+// Peak-hold decimation: keep the highest reading of each window
+static void trace_add(const int *values)
+{
+    for (int ch = 0; ch < trace_encoder.channels; ch++) {
+        if (trace_window_count == 0 || values[ch] > trace_window[ch]) {
+            trace_window[ch] = values[ch];
+        }
+    }
+    if (++trace_window_count == TRACE_DECIMATION) {
+        trace_encoder_add(&trace_encoder, trace_window);
+        trace_window_count = 0;
+    }
+}
+
+static void trace_commit(void)
+{
+    if (trace_window_count > 0) {
+        trace_encoder_add(&trace_encoder, trace_window);
+    }
+    size_t len = trace_encoder_finish(&trace_encoder);
+
+    if (trace_store_len > sizeof(trace_store)) {
+        sensor_manager_trace_clear();
+    }
+
+    // Drop the oldest bursts until the new one fits
+    while (trace_store_len > 0 && trace_store_len + len > sizeof(trace_store)) {
+        size_t oldest = trace_record_len(trace_store);
+        if (oldest == 0 || oldest > trace_store_len) {
+            sensor_manager_trace_clear();
+            break;
+        }
+        memmove(trace_store, trace_store + oldest, trace_store_len - oldest);
+        trace_store_len -= oldest;
+        trace_store_records--;
+    }
+
+    if (len > 0 && trace_store_len + len <= sizeof(trace_store)) {
+        memcpy(trace_store + trace_store_len, trace_work, len);
+        trace_store_len += len;
+        trace_store_records++;
+    }
+}
+
+size_t sensor_manager_trace_size(void)
+{
+    return trace_store_records ? sizeof(trace_blob_header_t) + trace_store_len : 0;
+}
+
+size_t sensor_manager_trace_snapshot(uint8_t *out, size_t out_len)
+{
+    size_t size = sensor_manager_trace_size();
+    if (size == 0 || size > out_len) {
+        return 0;
+    }
+
+    trace_blob_header_t header = {
+        .magic = TRACE_BLOB_MAGIC,
+        .version = TRACE_BLOB_VERSION,
+        .records = trace_store_records,
+        .length = trace_store_len,
+    };
+    memcpy(out, &header, sizeof(header));
+    memcpy(out + sizeof(header), trace_store, trace_store_len);
+    return size;
+}
+
+void sensor_manager_trace_clear(void)
+{
+    trace_store_len = 0;
+    trace_store_records = 0;
+}
+
 esp_err_t sensor_manager_init(adc_oneshot_unit_handle_t *adc1_handle)
 {
     adc_oneshot_unit_init_cfg_t init_config1 = {
@@ -18,48 +126,83 @@ esp_err_t sensor_manager_init(adc_oneshot_unit_handle_t *adc1_handle)
         .atten = ADC_ATTEN,
         .bitwidth = ADC_BITWIDTH_DEFAULT,
     };
-    
-    ESP_RETURN_ON_ERROR(adc_oneshot_config_channel(*adc1_handle, LDR1_ADC_CHANNEL, &config),
-                       TAG, "Failed to configure LDR1 channel");
-    ESP_RETURN_ON_ERROR(adc_oneshot_config_channel(*adc1_handle, LDR2_ADC_CHANNEL, &config),
-                       TAG, "Failed to configure LDR2 channel");
 
-    if (DEBUG_LOGS) printf("[%s] ADC initialized successfully\n", TAG);
+    for (int i = 0; i < SENSOR_COUNT; i++) {
+        sensor_config_t *sensor = &sensor_table[i];
+        sensor->threshold = device_config_sensor_threshold(i, sensor->threshold);
+        sensor->topic = device_config_sensor_topic(i, sensor->topic);
+
+        if (sensor->source == SENSOR_SOURCE_ADC) {
+            ESP_RETURN_ON_ERROR(adc_oneshot_config_channel(*adc1_handle, sensor->channel, &config),
+                               TAG, "Failed to configure sensor ADC channel");
+        } else {
+            // Pull down to ensure stable LOW when not triggered
+            const gpio_config_t pin_config = {
+                .pin_bit_mask = BIT64(sensor->channel),
+                .mode = GPIO_MODE_INPUT,
+                .pull_up_en = GPIO_PULLUP_DISABLE,
+                .pull_down_en = GPIO_PULLDOWN_ENABLE,
+                .intr_type = GPIO_INTR_DISABLE,
+            };
+            ESP_RETURN_ON_ERROR(gpio_config(&pin_config), TAG, "Failed to configure sensor wake pin");
+        }
+    }
+
+    BINLOG_D(SENSOR, ADC_INIT);
     return ESP_OK;
 }
 
-void sensor_manager_burst_sample(adc_oneshot_unit_handle_t adc1_handle,
-                                sensor_data_t *sensor1,
-                                sensor_data_t *sensor2)
+int sensor_manager_count(void)
+{
+    return SENSOR_COUNT;
+}
+
+const sensor_config_t *sensor_manager_get(int index)
+{
+    return &sensor_table[index];
+}
+
+int sensor_manager_read(adc_oneshot_unit_handle_t adc1_handle, int index)
+{
+    const sensor_config_t *sensor = &sensor_table[index];
+    int reading = 0;
+
+    if (sensor->source == SENSOR_SOURCE_WAKE_PIN) {
+        return gpio_get_level(sensor->channel) ? SENSOR_ADC_MAX : 0;
+    }
+    if (adc_oneshot_read(adc1_handle, sensor->channel, &reading) != ESP_OK) {
+        return 0;
+    }
+    return reading;
+}
+
+void sensor_manager_burst_sample(adc_oneshot_unit_handle_t adc1_handle, sensor_data_t *data)
 {
-    int reading1, reading2;
+    int readings[SENSOR_MAX_CHANNELS];
     int64_t start_time = esp_timer_get_time();
     int64_t elapsed_time = 0;
-    
+    int64_t burst_us = power_governor_burst_ms() * 1000LL;
+
     // Initialize sensor data
-    sensor1->max_value = 0;
-    sensor1->min_value = 4095;
-    
-    sensor2->max_value = 0;
-    sensor2->min_value = 4095;
+    for (int i = 0; i < SENSOR_COUNT; i++) {
+        sensor_data_reset(&data[i]);
+    }
 
     // Configure light sleep wakeup timer
     esp_sleep_enable_timer_wakeup(SAMPLE_INTERVAL_MS * 1000); // Convert ms to microseconds
 
+    // One trace channel per table entry
+    trace_begin((1u << SENSOR_COUNT) - 1);
+
     // Perform burst sampling
-    while (elapsed_time < (BURST_DURATION_MS * 1000)) { // Convert ms to microseconds
-        if (adc_oneshot_read(adc1_handle, LDR1_ADC_CHANNEL, &reading1) == ESP_OK) {
-            // Update min/max values for sensor 1
-            if (reading1 > sensor1->max_value) sensor1->max_value = reading1;
-            if (reading1 < sensor1->min_value) sensor1->min_value = reading1;
-        }
-        
-        if (adc_oneshot_read(adc1_handle, LDR2_ADC_CHANNEL, &reading2) == ESP_OK) {
-            // Update min/max values for sensor 2
-            if (reading2 > sensor2->max_value) sensor2->max_value = reading2;
-            if (reading2 < sensor2->min_value) sensor2->min_value = reading2;
+    while (elapsed_time < burst_us && !cycle_supervisor_expired()) {
+        for (int i = 0; i < SENSOR_COUNT; i++) {
+            readings[i] = sensor_manager_read(adc1_handle, i);
+            sensor_data_add_sample(&data[i], readings[i]);
         }
 
+        trace_add(readings);
+
         // Enter light sleep
         esp_light_sleep_start();
         
@@ -67,54 +210,48 @@ void sensor_manager_burst_sample(adc_oneshot_unit_handle_t adc1_handle,
         elapsed_time = esp_timer_get_time() - start_time;
     }
 
-    if (DEBUG_LOGS) {
-        printf("[%s] Burst sampling completed\n", TAG);
-        printf("[%s] Sensor 1 - Min: %d, Max: %d\n", TAG, sensor1->min_value, sensor1->max_value);
-        printf("[%s] Sensor 2 - Min: %d, Max: %d\n", TAG, sensor2->min_value, sensor2->max_value);
+    trace_commit();
+
+    for (int i = 0; i < SENSOR_COUNT; i++) {
+        BINLOG_D(SENSOR, SENSOR_BURST_DONE, i, data[i].min_value, data[i].max_value);
     }
 }
 
-void sensor_manager_sample_battery(adc_oneshot_unit_handle_t adc1_handle,
-                                 sensor_data_t *sensor2)
+uint32_t sensor_manager_mark_woken(uint64_t gpio_mask, sensor_data_t *data)
 {
-    int reading2;
-    int64_t start_time = esp_timer_get_time();
-    int64_t elapsed_time = 0;
-    
-    // Initialize sensor data
-    sensor2->max_value = 0;
-    sensor2->min_value = 4095;
-
-    // Configure light sleep wakeup timer
-    esp_sleep_enable_timer_wakeup(SAMPLE_INTERVAL_MS * 1000); // Convert ms to microseconds
+    uint32_t marked = 0;
 
-    // Perform burst sampling (battery only)
-    while (elapsed_time < (BURST_DURATION_MS * 1000)) { // Convert ms to microseconds
-        if (adc_oneshot_read(adc1_handle, LDR2_ADC_CHANNEL, &reading2) == ESP_OK) {
-            // Update min/max values for sensor 2 (battery)
-            if (reading2 > sensor2->max_value) sensor2->max_value = reading2;
-            if (reading2 < sensor2->min_value) sensor2->min_value = reading2;
+    for (int i = 0; i < SENSOR_COUNT; i++) {
+        const sensor_config_t *sensor = &sensor_table[i];
+        if (sensor->source == SENSOR_SOURCE_WAKE_PIN && (gpio_mask & BIT64(sensor->channel))) {
+            sensor_data_add_sample(&data[i], SENSOR_ADC_MAX);
+            marked |= 1u << i;
         }
-
-        // Enter light sleep
-        esp_light_sleep_start();
-        
-        // Update elapsed time after waking
-        elapsed_time = esp_timer_get_time() - start_time;
     }
+    return marked;
+}
 
-    if (DEBUG_LOGS) {
-        printf("[%s] Battery sampling completed\n", TAG);
-        printf("[%s] Battery sensor - Min: %d, Max: %d\n", TAG, sensor2->min_value, sensor2->max_value);
+uint64_t sensor_manager_wake_pin_mask(void)
+{
+    uint64_t mask = 0;
+
+    for (int i = 0; i < SENSOR_COUNT; i++) {
+        if (sensor_table[i].source == SENSOR_SOURCE_WAKE_PIN) {
+            mask |= BIT64(sensor_table[i].channel);
+        }
     }
+    return mask;
 }
 
-bool sensor_manager_is_trap_triggered(const sensor_data_t *sensor_data)
+bool sensor_manager_is_active(int index, const sensor_data_t *data)
 {
-    return (sensor_data->max_value > TRAP_THRESHOLD);
+    return sensor_data_above_threshold(data, sensor_table[index].threshold);
 }
 
-bool sensor_manager_is_battery_low(const sensor_data_t *sensor_data)
+const char *sensor_manager_state_payload(int index, bool active)
 {
-    return (sensor_data->max_value > BATTERY_THRESHOLD);
-}
\ No newline at end of file
+    if (sensor_table[index].role == SENSOR_ROLE_BATTERY) {
+        return active ? "low" : "ok";
+    }
+    return active ? "triggered" : "ready";
+}
@@ -0,0 +1,102 @@
+#include "telemetry.h"
+#include "mqtt_manager.h"
+#include "device_config.h"
+#include "cycle_supervisor.h"
+#include "mqtt_tls.h"
+#include "mem_stats.h"
+#include "ota_manager.h"
+#include "boot_timing.h"
+#include "power_governor.h"
+#include "link_adapt.h"
+#include "binlog.h"
+#include <stdio.h>
+
+static const char *abort_names[] = {
+    [CYCLE_ABORT_NONE] = "none",
+    [CYCLE_ABORT_BUDGET] = "budget",
+    [CYCLE_ABORT_ERROR] = "error",
+    [CYCLE_ABORT_RESET] = "reset",
+};
+
+bool telemetry_publish(void)
+{
+    static char payload[1024];  // Static to keep it off the main task stack
+    const cycle_stats_t *cycle = cycle_supervisor_stats();
+    const char *last_abort = cycle->last_abort <= CYCLE_ABORT_RESET ?
+                             abort_names[cycle->last_abort] : "unknown";
+
+    // TLS handshake counters, only when connecting with mqtts://
+    char tls_fields[192] = "";
+#if MQTT_USE_TLS
+    const mqtt_tls_stats_t *tls = mqtt_tls_stats();
+    snprintf(tls_fields, sizeof(tls_fields),
+        ",\"tls_full\":%u,\"tls_resumed\":%u,\"tls_failed\":%u,"
+        "\"tls_last\":\"%s\",\"tls_last_ms\":%lu,"
+        "\"tls_full_ms\":%lu,\"tls_resumed_ms\":%lu",
+        tls->full, tls->resumed, tls->failed,
+        tls->last_resumed ? "resumed" : "full", (unsigned long)tls->last_ms,
+        (unsigned long)tls->last_full_ms, (unsigned long)tls->last_resumed_ms);
+#endif
+
+    // Supply voltage and governor stage, only with the divider fitted
+    char power_fields[96] = "";
+#if SUPPLY_MONITOR_ENABLE
+    snprintf(power_fields, sizeof(power_fields),
+        ",\"supply_mv\":%d,\"supply_filtered_mv\":%d,\"power_stage\":\"%s\"",
+        power_governor_supply_mv(), power_governor_filtered_mv(),
+        power_governor_stage_name(power_governor_stage()));
+#endif
+
+    // Link adaptation: settings in use and recent connect results
+    const link_adapt_stats_t *link = link_adapt_stats();
+    char link_fields[224];
+    snprintf(link_fields, sizeof(link_fields),
+        ",\"wifi_level\":%u,\"wifi_tx_dbm\":%d,\"wifi_protocol\":\"%s\",\"rssi\":%d,\"rssi_avg\":%d,"
+        "\"wifi_connect_ms\":%lu,\"wifi_connects\":\"%d/%u\",\"wifi_failures\":%u",
+        link->level, link->tx_dbm, link_adapt_protocol_name(), link->last_rssi,
+        link->rssi_avg_x16 / 16, (unsigned long)link->last_connect_ms,
+        __builtin_popcount(link->history & ((1u << link->attempts) - 1)), link->attempts,
+        link->failures);
+
+    // Heap and stack high-water marks (sampled now, while the MQTT and
+    // network tasks are still running)
+    mem_stats_sample();
+    const mem_stats_t *mem = mem_stats_get();
+    char stack_fields[160] = "";
+    int stack_len = 0;
+    for (int i = 0; i < MEM_STATS_TASK_COUNT && stack_len < (int)sizeof(stack_fields); i++) {
+        if (mem->stack_min_free[i]) {
+            stack_len += snprintf(stack_fields + stack_len, sizeof(stack_fields) - stack_len,
+                                  "%s\"%s\":%u", stack_len ? "," : "",
+                                  mem_stats_task_name(i), mem->stack_min_free[i]);
+        }
+    }
+
+    const boot_timing_t *boot = boot_timing_get();
+
+    int len = snprintf(payload, sizeof(payload),
+        "{\"firmware\":\"%s\",\"cycles\":%lu,\"last_awake_ms\":%lu,\"max_awake_ms\":%lu,"
+        "\"overruns\":%u,\"errors\":%u,\"resets\":%u,"
+        "\"last_abort\":\"%s\",\"last_abort_phase\":\"%s\",\"last_abort_detail\":%ld,"
+        "\"heap_min_free\":%lu,\"heap_min_free_cycle\":%lu,\"heap_largest_block\":%lu,"
+        "\"boot_us\":%lu,\"boot_avg_us\":%lu,\"boot_max_us\":%lu,\"cold_boot_us\":%lu,"
+        "\"stack_min_free\":{%s}%s%s%s}",
+        ota_manager_running_version(),
+        (unsigned long)cycle->cycles, (unsigned long)cycle->last_awake_ms,
+        (unsigned long)cycle->max_awake_ms,
+        cycle->overruns, cycle->errors, cycle->resets,
+        last_abort, cycle_supervisor_phase_name(cycle->last_phase),
+        (long)cycle->last_detail,
+        (unsigned long)mem->heap_min_free, (unsigned long)mem->heap_min_free_cycle,
+        (unsigned long)mem->heap_largest_block,
+        (unsigned long)boot->last_us, (unsigned long)boot->wake_avg_us,
+        (unsigned long)boot->wake_max_us, (unsigned long)boot->cold_us,
+        stack_fields, link_fields, power_fields, tls_fields);
+
+    if (len < 0 || len >= (int)sizeof(payload) ||
+        !mqtt_manager_publish(device_config_topic(DEVICE_TOPIC_TELEMETRY), payload, 1, 1)) {
+        BINLOG_E(TELEMETRY, TELEMETRY_FAILED);
+        return false;
+    }
+    return true;
+}
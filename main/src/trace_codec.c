@@ -0,0 +1,73 @@
+#include "trace_codec.h"
+
+static void put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+void trace_encoder_begin(trace_encoder_t *enc, uint8_t *buf, size_t cap,
+                         uint16_t burst_seq, uint8_t channel_mask,
+                         uint8_t decimation, uint16_t interval_ms)
+{
+    enc->buf = buf;
+    enc->cap = cap;
+    enc->len = TRACE_RECORD_HEADER_SIZE;
+    enc->channels = __builtin_popcount(channel_mask);
+    enc->samples = 0;
+    enc->full = (cap < TRACE_RECORD_HEADER_SIZE);
+    for (int i = 0; i < TRACE_CODEC_MAX_CHANNELS; i++) {
+        enc->prev[i] = 0;
+    }
+
+    if (!enc->full) {
+        put_u16(buf + 2, burst_seq);
+        buf[4] = channel_mask;
+        buf[5] = decimation;
+        put_u16(buf + 6, interval_ms);
+    }
+}
+
+bool trace_encoder_add(trace_encoder_t *enc, const int *values)
+{
+    uint8_t tmp[TRACE_CODEC_MAX_CHANNELS * 5];
+    size_t n = 0;
+
+    if (enc->full || enc->samples == UINT16_MAX) {
+        return false;
+    }
+
+    for (int ch = 0; ch < enc->channels; ch++) {
+        int32_t delta = values[ch] - enc->prev[ch];
+        uint32_t zz = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+        do {
+            uint8_t byte = zz & 0x7F;
+            zz >>= 7;
+            tmp[n++] = byte | (zz ? 0x80 : 0);
+        } while (zz);
+    }
+
+    // Only commit whole samples so the record always decodes cleanly
+    if (enc->len + n > enc->cap) {
+        enc->full = true;
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        enc->buf[enc->len++] = tmp[i];
+    }
+    for (int ch = 0; ch < enc->channels; ch++) {
+        enc->prev[ch] = values[ch];
+    }
+    enc->samples++;
+    return true;
+}
+
+size_t trace_encoder_finish(trace_encoder_t *enc)
+{
+    if (enc->cap < TRACE_RECORD_HEADER_SIZE) {
+        return 0;
+    }
+    put_u16(enc->buf, enc->len);
+    put_u16(enc->buf + 8, enc->samples);
+    return enc->len;
+}
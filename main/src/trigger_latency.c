@@ -0,0 +1,109 @@
+#include "trigger_latency.h"
+#include "boot_timing.h"
+#include "binlog.h"
+#include "device_config.h"
+#include "mqtt_manager.h"
+#include <stdio.h>
+#include "esp_timer.h"
+
+RTC_DATA_ATTR static trigger_latency_stats_t stats;
+
+// This wake: RTC wake time, and esp_timer at boot_timing_record
+static uint64_t wake_us = 0;
+static int64_t app_main_us = 0;
+static uint32_t boot_us = 0;
+static uint32_t trigger_sensors = 0;
+
+void FAST_BOOT_IRAM trigger_latency_capture(void)
+{
+    app_main_us = esp_timer_get_time();
+    boot_us = boot_timing_get()->last_us;
+    wake_us = boot_us ? boot_timing_wake_us() : 0;
+}
+
+void trigger_latency_set_sensors(uint32_t sensors)
+{
+    trigger_sensors = sensors;
+}
+
+uint32_t trigger_latency_pending(void)
+{
+    return wake_us != 0 ? trigger_sensors : 0;
+}
+
+// Milliseconds from the trigger to esp_timer time now_us
+static uint32_t since_trigger_ms(int64_t now_us)
+{
+    return (uint32_t)((boot_us + (now_us - app_main_us)) / 1000);
+}
+
+static void record(uint32_t latency_ms)
+{
+    int bucket = 0;
+    while (bucket < TRIGGER_LATENCY_BUCKETS - 1 && latency_ms >= (1000u << bucket)) {
+        bucket++;
+    }
+    if (stats.buckets[bucket] < UINT16_MAX) {
+        stats.buckets[bucket]++;
+    }
+    if (stats.count == 0 || latency_ms < stats.min_ms) {
+        stats.min_ms = latency_ms;
+    }
+    if (latency_ms > stats.max_ms) {
+        stats.max_ms = latency_ms;
+    }
+    stats.last_ms = latency_ms;
+    stats.total_ms += latency_ms;
+    stats.count++;
+}
+
+void trigger_latency_report(void)
+{
+    if (!trigger_latency_pending()) {
+        return;
+    }
+
+    int64_t ack_us = mqtt_manager_wait_acked(TRIGGER_PUBACK_TIMEOUT_MS);
+    char latency[16] = "null";
+    if (ack_us >= 0) {
+        uint32_t latency_ms = since_trigger_ms(ack_us);
+        record(latency_ms);
+        snprintf(latency, sizeof(latency), "%lu", (unsigned long)latency_ms);
+        BINLOG_I(MAIN, TRIGGER_LATENCY, latency_ms, boot_us / 1000);
+    } else {
+        stats.missed++;
+        BINLOG_W(MAIN, TRIGGER_NO_PUBACK, TRIGGER_PUBACK_TIMEOUT_MS);
+    }
+
+    char histogram[160];
+    int len = 0;
+    for (int i = 0; i < TRIGGER_LATENCY_BUCKETS && len < (int)sizeof(histogram); i++) {
+        if (i < TRIGGER_LATENCY_BUCKETS - 1) {
+            len += snprintf(histogram + len, sizeof(histogram) - len, "%s\"%u\":%u",
+                            i ? "," : "", 1000u << i, stats.buckets[i]);
+        } else {
+            len += snprintf(histogram + len, sizeof(histogram) - len, ",\"inf\":%u", stats.buckets[i]);
+        }
+    }
+
+    char payload[384];
+    len = snprintf(payload, sizeof(payload),
+        "{\"sensors\":%lu,\"rtc_ms\":%llu,\"age_ms\":%lu,\"latency_ms\":%s,\"boot_ms\":%lu,"
+        "\"count\":%lu,\"missed\":%lu,\"min_ms\":%lu,\"avg_ms\":%lu,\"max_ms\":%lu,"
+        "\"histogram\":{%s}}",
+        (unsigned long)trigger_sensors, (unsigned long long)(wake_us / 1000),
+        (unsigned long)since_trigger_ms(esp_timer_get_time()), latency,
+        (unsigned long)(boot_us / 1000),
+        (unsigned long)stats.count, (unsigned long)stats.missed, (unsigned long)stats.min_ms,
+        (unsigned long)(stats.count ? stats.total_ms / stats.count : 0), (unsigned long)stats.max_ms,
+        histogram);
+    if (len > 0 && len < (int)sizeof(payload)) {
+        mqtt_manager_publish(device_config_topic(DEVICE_TOPIC_TRIGGER), payload, 1, 1);
+    }
+    trigger_sensors = 0;
+}
+
+const trigger_latency_stats_t *trigger_latency_stats(void)
+{
+    return &stats;
+}
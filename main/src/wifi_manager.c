@@ -1,10 +1,13 @@
 #include "wifi_manager.h"
+#include "binlog.h"
+#include "cycle_supervisor.h"
+#include "power_governor.h"
+#include "link_adapt.h"
 #include "secrets.h"
 #include "config.h"
 #include <string.h>
 #include <stdio.h>
-
-static const char *TAG = "wifi_manager";
+#include "esp_timer.h"
 
 void wifi_manager_event_handler(void *arg, esp_event_base_t event_base,
                               int32_t event_id, void *event_data)
@@ -12,53 +15,59 @@ void wifi_manager_event_handler(void *arg, esp_event_base_t event_base,
     if (event_base == WIFI_EVENT) {
         switch (event_id) {
             case WIFI_EVENT_STA_START:
-                if (DEBUG_LOGS) printf("[%s] WiFi station started, attempting to connect...\n", TAG);
+                BINLOG_D(WIFI, WIFI_STA_START);
                 esp_wifi_connect();
                 break;
             case WIFI_EVENT_STA_CONNECTED:
-                if (DEBUG_LOGS) printf("[%s] WiFi station connected to AP\n", TAG);
+                BINLOG_D(WIFI, WIFI_STA_CONNECTED);
                 break;
             case WIFI_EVENT_STA_DISCONNECTED: {
                 wifi_event_sta_disconnected_t* event = (wifi_event_sta_disconnected_t*) event_data;
-                if (DEBUG_LOGS) printf("[%s] WiFi disconnected, reason: %d\n", TAG, event->reason);
+                BINLOG_D(WIFI, WIFI_DISCONNECTED, event->reason);
                 esp_wifi_connect();
                 break;
             }
             case WIFI_EVENT_STA_AUTHMODE_CHANGE:
-                if (DEBUG_LOGS) printf("[%s] WiFi authentication mode changed\n", TAG);
+                BINLOG_D(WIFI, WIFI_AUTHMODE);
                 break;
         }
     } else if (event_base == IP_EVENT) {
         if (event_id == IP_EVENT_STA_GOT_IP) {
             ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
-            if (DEBUG_LOGS) printf("[%s] Got IP address: " IPSTR "\n", TAG, IP2STR(&event->ip_info.ip));
+            BINLOG_D(WIFI, WIFI_GOT_IP, IP2STR(&event->ip_info.ip));
         }
     }
 }
 
-bool wifi_manager_init(void)
+// The netif, event loop and driver are set up once per boot, so a failed
+// connect can be retried by calling wifi_manager_init again
+static bool driver_ready = false;
+
+static void wifi_manager_setup(void)
 {
-    ESP_ERROR_CHECK(esp_netif_init());
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    CYCLE_CHECK(esp_netif_init());
+    CYCLE_CHECK(esp_event_loop_create_default());
     esp_netif_create_default_wifi_sta();
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+    CYCLE_CHECK(esp_wifi_init(&cfg));
 
     uint8_t mac[6];
     esp_read_mac(mac, ESP_MAC_WIFI_STA);
-    if (DEBUG_LOGS) {
-        printf("[%s] =========================\n", TAG);
-        printf("[%s] Device MAC: %02x:%02x:%02x:%02x:%02x:%02x\n", TAG,
-               mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-        printf("[%s] =========================\n", TAG);
-        printf("[%s] Initializing WiFi with SSID: %s\n", TAG, WIFI_SSID);
-    }
+    BINLOG_D(WIFI, WIFI_MAC, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
     
-    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID,
+    CYCLE_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID,
                                              &wifi_manager_event_handler, NULL));
-    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP,
+    CYCLE_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP,
                                              &wifi_manager_event_handler, NULL));
+    driver_ready = true;
+}
+
+bool wifi_manager_init(void)
+{
+    if (!driver_ready) {
+        wifi_manager_setup();
+    }
 
     wifi_config_t wifi_config = {
         .sta = {
@@ -73,22 +82,28 @@ bool wifi_manager_init(void)
     memcpy(wifi_config.sta.ssid, WIFI_SSID, strlen(WIFI_SSID));
     memcpy(wifi_config.sta.password, WIFI_PASS, strlen(WIFI_PASS));
 
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+    CYCLE_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+    CYCLE_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+
+    // 802.11 mode chosen from past connects (TX power follows the start)
+    link_adapt_apply(false);
     
     // Enable WiFi power save mode for maximum power efficiency
-    ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_MIN_MODEM));
+    CYCLE_CHECK(esp_wifi_set_ps(WIFI_PS_MIN_MODEM));
     
-    ESP_ERROR_CHECK(esp_wifi_start());
+    int64_t start_us = esp_timer_get_time();
+    CYCLE_CHECK(esp_wifi_start());
+    link_adapt_apply(true);
 
-    if (DEBUG_LOGS) printf("[%s] WiFi started, waiting for connection...\n", TAG);
+    BINLOG_D(WIFI, WIFI_STARTED);
 
     // Wait for connection and IP with timeout
     int retry_count = 0;
-    const int max_retries = 30; // 30 * 500ms = 15 second timeout
+    const int max_retries = power_governor_retries(30); // 30 * 500ms = 15 seconds, less in low power stages
     bool got_ip = false;
+    int rssi = 0;
 
-    while (retry_count < max_retries) {
+    while (retry_count < max_retries && !cycle_supervisor_expired()) {
         wifi_ap_record_t ap_info;
         esp_netif_ip_info_t ip_info;
         esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
@@ -96,10 +111,8 @@ bool wifi_manager_init(void)
         if (esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK) {
             if (esp_netif_get_ip_info(netif, &ip_info) == ESP_OK && ip_info.ip.addr != 0) {
                 got_ip = true;
-                if (DEBUG_LOGS) {
-                    printf("[%s] Connected to AP, RSSI: %d\n", TAG, ap_info.rssi);
-                    printf("[%s] IP Address: " IPSTR "\n", TAG, IP2STR(&ip_info.ip));
-                }
+                rssi = ap_info.rssi;
+                BINLOG_D(WIFI, WIFI_RSSI, ap_info.rssi);
                 break;
             }
         }
@@ -107,8 +120,13 @@ bool wifi_manager_init(void)
         retry_count++;
     }
 
+    // A connect cut short by the awake budget says nothing about the link
+    if (got_ip || !cycle_supervisor_expired()) {
+        link_adapt_record(got_ip, rssi, (esp_timer_get_time() - start_us) / 1000);
+    }
+
     if (!got_ip) {
-        printf("[%s] Failed to get IP address within timeout period\n", TAG);
+        BINLOG_E(WIFI, WIFI_TIMEOUT);
         esp_wifi_stop();
         return false;
     }
@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+"""Compare two replay_bench JSON reports and fail on regressions.
+
+    ./replay_bench -j > baseline.json          # on the known good revision
+    ./replay_bench -j > current.json           # after the change
+    python tools/bench_compare.py baseline.json current.json
+
+A scenario regresses when a channel's false positive or false negative rate
+rises by more than --rate-tolerance, or when publishes, awake time or charge
+per day grow by more than --energy-tolerance (relative). Scenarios present in
+only one report are listed but do not fail the comparison. Exits 1 if
+anything regressed, so it can gate a CI job or a bisect.
+"""
+
+import argparse
+import json
+import sys
+
+CHANNELS = ("trap", "battery")
+RATES = ("fp_rate", "fn_rate")
+ENERGY = ("sessions", "messages", "awake_ms_per_wake", "charge_mah_per_day")
+
+
+def load(path):
+    with open(path) as f:
+        report = json.load(f)
+    return report.get("config", {}), {s["name"]: s for s in report["scenarios"]}
+
+
+def compare(name, base, cur, args):
+    """List of (metric, baseline, current, regressed) for one scenario."""
+    rows = []
+    for channel in CHANNELS:
+        for rate in RATES:
+            b, c = base[channel][rate], cur[channel][rate]
+            if b is None or c is None:
+                continue
+            rows.append(("%s.%s" % (channel, rate), b, c, c - b > args.rate_tolerance))
+    for metric in ENERGY:
+        b, c = base[metric], cur[metric]
+        rows.append((metric, b, c, c > b * (1 + args.energy_tolerance) and c - b > 1e-9))
+    b, c = base["samples_to_decide_mean"], cur["samples_to_decide_mean"]
+    rows.append(("samples_to_decide_mean", b, c, False))  # Informational
+    return rows
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--rate-tolerance", type=float, default=0.0,
+                        help="allowed absolute rise of a FP/FN rate (default 0)")
+    parser.add_argument("--energy-tolerance", type=float, default=0.02,
+                        help="allowed relative rise of publishes, awake time and charge (default 0.02)")
+    parser.add_argument("-v", "--verbose", action="store_true", help="print every metric, not just changes")
+    args = parser.parse_args()
+
+    base_config, base = load(args.baseline)
+    cur_config, cur = load(args.current)
+    if base_config != cur_config:
+        print("warning: benchmark options differ between the reports:")
+        for key in sorted(set(base_config) | set(cur_config)):
+            if base_config.get(key) != cur_config.get(key):
+                print("  %s: %s -> %s" % (key, base_config.get(key), cur_config.get(key)))
+
+    regressions = 0
+    for name in sorted(set(base) | set(cur)):
+        if name not in cur:
+            print("%s: missing from %s" % (name, args.current))
+            continue
+        if name not in base:
+            print("%s: new (not in %s)" % (name, args.baseline))
+            continue
+        for metric, b, c, regressed in compare(name, base[name], cur[name], args):
+            if regressed:
+                regressions += 1
+            if regressed or args.verbose or b != c:
+                print("%-8s %-16s %-24s %10s -> %-10s" % ("REGRESS" if regressed else "", name, metric, b, c))
+
+    if regressions:
+        print("%d regression(s)" % regressions)
+        sys.exit(1)
+    print("no regressions")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+"""Decode binary log buffers produced by the firmware's binlog module.
+
+Input can be either:
+  - a raw blob as uploaded over MQTT, e.g.
+        mosquitto_sub -h broker -t home/mousetrap/backdoor/log -C 1 > log.bin
+  - a captured console log from diagnostic mode containing "BINLOG <hex>" lines
+
+Format strings and tag names are read from main/include/binlog_ids.h, so
+always decode with the source tree matching the firmware that wrote the log.
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+BINLOG_MAGIC = 0x31474C42
+HEADER = struct.Struct("<IHHI")
+LEVELS = ["E", "W", "I", "D"]
+
+DEFAULT_IDS = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                           "..", "main", "include", "binlog_ids.h")
+
+
+def load_tables(path):
+    text = open(path, encoding="utf-8").read()
+    tables = {}
+    for name in ("BINLOG_TAGS", "BINLOG_FORMATS"):
+        m = re.search(r"#define\s+%s\(X\)(.*?)(?:\n\s*\n|\n#)" % name, text, re.S)
+        if not m:
+            sys.exit("could not find %s in %s" % (name, path))
+        tables[name] = re.findall(r'X\(\s*(\w+)\s*,\s*"((?:[^"\\]|\\.)*)"\s*\)', m.group(1))
+    return tables["BINLOG_TAGS"], tables["BINLOG_FORMATS"]
+
+
+def read_blobs(path):
+    data = open(path, "rb").read()
+    if len(data) >= 4 and struct.unpack_from("<I", data)[0] == BINLOG_MAGIC:
+        return [data]
+
+    # Console capture: collect hex lines until each "BINLOG END"
+    blobs, current = [], bytearray()
+    for line in data.decode("utf-8", "replace").splitlines():
+        m = re.search(r"BINLOG (\S+)", line)
+        if not m:
+            continue
+        if m.group(1) == "END":
+            blobs.append(bytes(current))
+            current = bytearray()
+        else:
+            current += bytes.fromhex(m.group(1))
+    return blobs
+
+
+def signed(value):
+    return value - (1 << 32) if value & 0x80000000 else value
+
+
+def decode_blob(blob, tags, formats, out):
+    if len(blob) < HEADER.size:
+        return
+    magic, boot_seq, words, dropped = HEADER.unpack_from(blob)
+    if magic != BINLOG_MAGIC:
+        out.write("bad magic 0x%08x, skipping\n" % magic)
+        return
+    body = struct.unpack_from("<%dI" % words, blob, HEADER.size)
+    out.write("# boot sequence %d, %d words, %d records dropped\n" % (boot_seq, words, dropped))
+
+    i = 0
+    while i + 1 < len(body):
+        header, stamp = body[i], body[i + 1]
+        level = LEVELS[header >> 30]
+        nargs = (header >> 27) & 0x7
+        tag = (header >> 21) & 0x3F
+        fmt = header & 0xFFF
+        args = [signed(a) for a in body[i + 2:i + 2 + nargs]]
+        i += 2 + nargs
+
+        tag_name = tags[tag][1] if tag < len(tags) else "tag%d" % tag
+        if fmt < len(formats):
+            try:
+                text = formats[fmt][1] % tuple(args)
+            except (TypeError, ValueError):
+                text = "%s %r" % (formats[fmt][1], args)
+        else:
+            text = "unknown format %d %r" % (fmt, args)
+
+        out.write("[boot %4d %7d ms] %s %s: %s\n" % (stamp >> 20, stamp & 0xFFFFF, level, tag_name, text))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", help="raw blob or console capture")
+    parser.add_argument("--ids", default=DEFAULT_IDS, help="path to binlog_ids.h")
+    args = parser.parse_args()
+
+    tags, formats = load_tables(args.ids)
+    blobs = read_blobs(args.input)
+    if not blobs:
+        sys.exit("no binlog data found in %s" % args.input)
+    for blob in blobs:
+        decode_blob(blob, tags, formats, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
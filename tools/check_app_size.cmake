@@ -0,0 +1,20 @@
+# Fails the build when the application image is larger than APP_SIZE_BUDGET.
+# Run by the app_size_check target in the top-level CMakeLists.txt.
+#
+# Usage: cmake -DAPP_BIN=<image.bin> -DAPP_SIZE_BUDGET=<bytes> -P check_app_size.cmake
+
+if(NOT EXISTS "${APP_BIN}")
+    message(FATAL_ERROR "Application image '${APP_BIN}' not found")
+endif()
+
+file(SIZE "${APP_BIN}" app_size)
+math(EXPR headroom "${APP_SIZE_BUDGET} - ${app_size}")
+
+if(app_size GREATER APP_SIZE_BUDGET)
+    math(EXPR over "-${headroom}")
+    message(FATAL_ERROR "Application image is ${app_size} bytes, "
+                        "${APP_SIZE_BUDGET} allowed (over by ${over} bytes). "
+                        "Trim features or raise -DAPP_SIZE_BUDGET.")
+endif()
+
+message(STATUS "Application image: ${app_size} of ${APP_SIZE_BUDGET} bytes (${headroom} bytes free)")
@@ -0,0 +1,246 @@
+// delta_apply - rebuild a firmware image from a source image and an OTA
+// delta made by tools/ota_delta.py, using the firmware's patch code
+// (main/src/delta_patch.c).
+//
+// Use it to check a delta before publishing it: the output must be
+// byte-identical to the new build/halightsensor.bin. Like the firmware,
+// it hashes the output as it is written and fails if the SHA-256 does not
+// match the one recorded in the delta header.
+//
+// Build (from the repository root):
+//   cc -O2 -Imain/include -o delta_apply tools/delta_apply.c main/src/delta_patch.c -lz
+//
+// Usage:
+//   ./delta_apply source.bin delta.ldrd target.bin
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "delta_patch.h"
+
+// Minimal SHA-256 (FIPS 180-4), so the tool needs nothing beyond zlib
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t block[64];
+    size_t used;
+} sha256_t;
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(sha256_t *sha, const uint8_t *p)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 |
+               (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = sha->state[0], b = sha->state[1], c = sha->state[2], d = sha->state[3];
+    uint32_t e = sha->state[4], f = sha->state[5], g = sha->state[6], h = sha->state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) +
+                      sha256_k[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    sha->state[0] += a; sha->state[1] += b; sha->state[2] += c; sha->state[3] += d;
+    sha->state[4] += e; sha->state[5] += f; sha->state[6] += g; sha->state[7] += h;
+}
+
+static void sha256_init(sha256_t *sha)
+{
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(sha->state, iv, sizeof(iv));
+    sha->length = 0;
+    sha->used = 0;
+}
+
+static void sha256_update(sha256_t *sha, const uint8_t *data, size_t len)
+{
+    sha->length += len;
+    while (len > 0) {
+        size_t take = sizeof(sha->block) - sha->used;
+        if (take > len) {
+            take = len;
+        }
+        memcpy(sha->block + sha->used, data, take);
+        sha->used += take;
+        data += take;
+        len -= take;
+        if (sha->used == sizeof(sha->block)) {
+            sha256_block(sha, sha->block);
+            sha->used = 0;
+        }
+    }
+}
+
+static void sha256_finish(sha256_t *sha, uint8_t digest[32])
+{
+    uint64_t bits = sha->length * 8;
+    uint8_t pad[72] = { 0x80 };
+    size_t pad_len = (sha->used < 56 ? 56 : 120) - sha->used;
+    for (int i = 0; i < 8; i++) {
+        pad[pad_len + i] = (uint8_t)(bits >> (56 - 8 * i));
+    }
+    sha256_update(sha, pad, pad_len + 8);
+    for (int i = 0; i < 8; i++) {
+        digest[4 * i] = (uint8_t)(sha->state[i] >> 24);
+        digest[4 * i + 1] = (uint8_t)(sha->state[i] >> 16);
+        digest[4 * i + 2] = (uint8_t)(sha->state[i] >> 8);
+        digest[4 * i + 3] = (uint8_t)sha->state[i];
+    }
+}
+
+typedef struct {
+    const uint8_t *source;
+    size_t source_len;
+    FILE *out;
+    sha256_t sha;
+} apply_ctx_t;
+
+static int read_source(void *ctx, uint32_t offset, uint8_t *buf, size_t len)
+{
+    apply_ctx_t *apply = ctx;
+    if (offset > apply->source_len || len > apply->source_len - offset) {
+        return -1;
+    }
+    memcpy(buf, apply->source + offset, len);
+    return 0;
+}
+
+static int write_target(void *ctx, const uint8_t *data, size_t len)
+{
+    apply_ctx_t *apply = ctx;
+    sha256_update(&apply->sha, data, len);
+    return fwrite(data, 1, len, apply->out) == len ? 0 : -1;
+}
+
+static uint8_t *load_file(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(size > 0 ? size : 1);
+    if (!data || fread(data, 1, size, f) != (size_t)size) {
+        fprintf(stderr, "%s: read failed\n", path);
+        free(data);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    *len = size;
+    return data;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 4) {
+        fprintf(stderr, "usage: %s source.bin delta.ldrd target.bin\n", argv[0]);
+        return 2;
+    }
+
+    size_t source_len, delta_len;
+    uint8_t *source = load_file(argv[1], &source_len);
+    uint8_t *delta = load_file(argv[2], &delta_len);
+    if (!source || !delta) {
+        return 1;
+    }
+
+    const delta_header_t *header = (const delta_header_t *)delta;
+    if (delta_len < sizeof(*header) || delta_header_check(header) != 0) {
+        fprintf(stderr, "%s: not a version %d delta\n", argv[2], DELTA_VERSION);
+        return 1;
+    }
+    if (source_len < DELTA_APP_ELF_SHA256_OFFSET + 32 || header->source_size > source_len ||
+        memcmp(source + DELTA_APP_ELF_SHA256_OFFSET, header->source_id, 32) != 0) {
+        fprintf(stderr, "%s: delta was not made against %s\n", argv[2], argv[1]);
+        return 1;
+    }
+
+    apply_ctx_t apply = { .source = source, .source_len = header->source_size };
+    apply.out = fopen(argv[3], "wb");
+    if (!apply.out) {
+        perror(argv[3]);
+        return 1;
+    }
+    sha256_init(&apply.sha);
+
+    delta_patch_t patch;
+    delta_patch_init(&patch, header->source_size, header->target_size,
+                     read_source, write_target, &apply);
+
+    const uint8_t *body = delta + sizeof(*header);
+    size_t body_len = delta_len - sizeof(*header);
+    int rc = DELTA_OK;
+
+    if (header->flags & DELTA_FLAG_ZLIB) {
+        // Inflate in small pieces, the way the firmware sees a download
+        uint8_t out[1024];
+        z_stream zs = { .next_in = (Bytef *)body, .avail_in = body_len };
+        int zrc = inflateInit(&zs);
+        while (zrc == Z_OK && rc == DELTA_OK) {
+            zs.next_out = out;
+            zs.avail_out = sizeof(out);
+            zrc = inflate(&zs, Z_NO_FLUSH);
+            if (zrc == Z_OK || zrc == Z_STREAM_END) {
+                rc = delta_patch_feed(&patch, out, sizeof(out) - zs.avail_out);
+            }
+        }
+        if (zrc != Z_STREAM_END && rc >= DELTA_OK) {
+            fprintf(stderr, "%s: corrupt compressed stream (%d)\n", argv[2], zrc);
+            rc = DELTA_ERR_OP;
+        }
+        inflateEnd(&zs);
+    } else {
+        rc = delta_patch_feed(&patch, body, body_len);
+    }
+
+    fclose(apply.out);
+    if (rc != DELTA_DONE || patch.written != header->target_size) {
+        fprintf(stderr, "%s: patch failed (result %d, %u of %u bytes written)\n",
+                argv[2], rc, patch.written, header->target_size);
+        return 1;
+    }
+
+    uint8_t digest[32];
+    sha256_finish(&apply.sha, digest);
+    if (memcmp(digest, header->target_sha256, sizeof(digest)) != 0) {
+        fprintf(stderr, "%s: SHA-256 of the rebuilt image does not match the delta header - "
+                "do not publish this delta\n", argv[3]);
+        return 1;
+    }
+
+    printf("%s: %u bytes from %zu byte delta (%.1f%% of target)\n", argv[3],
+           header->target_size, delta_len, 100.0 * delta_len / header->target_size);
+    free(source);
+    free(delta);
+    return 0;
+}
@@ -0,0 +1,454 @@
+#!/usr/bin/env python3
+"""Simulate a fleet of traps against an MQTT broker, to size the broker and
+choose heartbeat staggering before rollout.
+
+Each simulated trap follows the firmware's wake cycle: it wakes every sleep
+interval (or on a trigger, with --wake-circuit), and only connects when a
+state changed or a heartbeat is due. A session repeats what the firmware
+does, in the same order:
+  connect with the availability last will ("offline", QoS 1, retained),
+  poll for the CONNACK every --connect-poll seconds (mqtt_manager_init),
+  publish "online", then the changed (or all) states, then (on a wake
+  circuit trigger) the trigger event once the states are acknowledged, then telemetry,
+  check the retained log/trace requests (and the OTA request on heartbeats)
+  with one subscription,
+  upload the burst trace on heartbeats (retained, waiting for its PUBACK),
+  wait --settle seconds, disconnect.
+Everything is QoS 1 and retained, like the firmware, with topics
+<prefix>/<trap>/state, /battery, /availability, /trigger and /telemetry.
+
+    python tools/fleet_sim.py --traps 300 --time-scale 600 --duration 300 \\
+        --align aligned --trigger-rate 2 --sys
+
+The sleep interval and heartbeat are simulated time; --time-scale speeds
+them up (600 turns a 30 minute sleep into 3 seconds and a 24 hour heartbeat
+into 144 seconds). Sessions themselves run in real time. Reports connect
+latency (CONNECT to CONNACK), PUBACK latency, session length and message
+throughput. --sys also records the broker's own $SYS statistics (Mosquitto).
+
+Requires paho-mqtt 2.x (pip install paho-mqtt).
+"""
+
+import argparse
+import heapq
+import json
+import random
+import threading
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+import paho.mqtt.client as mqtt
+from paho.mqtt.enums import CallbackAPIVersion
+
+RETAINED_GRACE = 0.2   # RETAINED_GRACE_MS in mqtt_manager.c
+TRIGGER_PUBACK_TIMEOUT = 5.0  # TRIGGER_PUBACK_TIMEOUT_MS in trigger_latency.h
+UPLOAD_ACK_TIMEOUT = 5.0  # MQTT_UPLOAD_ACK_TIMEOUT_MS in mqtt_manager.h
+CONNECT_TIMEOUT = 10.0  # mqtt_manager_init gives up after 5 polls of 2 seconds
+
+
+def percentile(values, pct):
+    if not values:
+        return 0.0
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * pct / 100.0))]
+
+
+def summarize(values):
+    """p50/p90/p99/max in milliseconds."""
+    return {
+        "count": len(values),
+        "p50_ms": round(percentile(values, 50) * 1000, 1),
+        "p90_ms": round(percentile(values, 90) * 1000, 1),
+        "p99_ms": round(percentile(values, 99) * 1000, 1),
+        "max_ms": round(max(values) * 1000, 1) if values else 0.0,
+    }
+
+
+class Stats:
+    """Counters and latency samples, for the whole run and the current report interval."""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.total = self._empty()
+        self.interval = self._empty()
+
+    @staticmethod
+    def _empty():
+        return {"sessions": 0, "heartbeats": 0, "failed": 0, "abrupt": 0, "messages": 0,
+                "bytes": 0, "connect": [], "puback": [], "session": [], "lag": []}
+
+    def add(self, key, value=1):
+        with self.lock:
+            for bucket in (self.total, self.interval):
+                if isinstance(bucket[key], list):
+                    bucket[key].append(value)
+                else:
+                    bucket[key] += value
+
+    def take_interval(self):
+        with self.lock:
+            interval, self.interval = self.interval, self._empty()
+        return interval
+
+
+class Trap:
+    """Firmware state kept in RTC memory, plus the simulated sensors."""
+
+    def __init__(self, index, args, first_wake):
+        self.name = args.id_format % index
+        self.client_id = "ESP32_%06x" % index
+        self.topic = "%s/%s" % (args.prefix, self.name)
+        self.next_wake = first_wake
+        self.last_wake = first_wake
+        self.timer_wake = True
+        self.drift = 1.0 + random.uniform(-args.drift, args.drift) / 100.0
+        self.initialized = False
+        self.cycles_since_publish = 0
+        self.triggered = False
+        self.battery_low = False
+        self.published = {"state": None, "battery": None}
+        self.cycles = 0
+
+
+class Session:
+    """One connect/publish/teardown sequence, driven from a worker thread."""
+
+    def __init__(self, trap, args, stats):
+        self.trap = trap
+        self.args = args
+        self.stats = stats
+        self.connected = False
+        self.connect_failed = False
+        self.pending = {}
+        self.subacks = set()
+        self.retained = set()
+        self.client = mqtt.Client(CallbackAPIVersion.VERSION2, client_id=trap.client_id,
+                                  clean_session=True, protocol=mqtt.MQTTv311)
+        if args.username:
+            self.client.username_pw_set(args.username, args.password)
+        self.client.will_set(trap.topic + "/availability", "offline", qos=1, retain=True)
+        self.client.on_connect = self.on_connect
+        self.client.on_publish = self.on_publish
+        self.client.on_subscribe = self.on_subscribe
+        self.client.on_message = self.on_message
+
+    def on_connect(self, client, userdata, flags, reason_code, properties):
+        if reason_code.is_failure:
+            self.connect_failed = True
+            return
+        self.connected = True
+        self.stats.add("connect", time.monotonic() - self.connect_start)
+        # The firmware publishes "online" from its CONNECTED event
+        self.publish(self.trap.topic + "/availability", "online")
+
+    def on_publish(self, client, userdata, mid, reason_code, properties):
+        start = self.pending.pop(mid, None)
+        if start is not None:
+            self.stats.add("puback", time.monotonic() - start)
+
+    def on_subscribe(self, client, userdata, mid, reason_codes, properties):
+        self.subacks.add(mid)
+
+    def on_message(self, client, userdata, message):
+        if message.retain and message.payload:
+            self.retained.add(message.topic)
+
+    def loop_until(self, done, timeout):
+        deadline = time.monotonic() + timeout
+        while not done() and time.monotonic() < deadline:
+            self.client.loop(timeout=0.005)
+        return done()
+
+    def publish(self, topic, payload, retain=True):
+        info = self.client.publish(topic, payload, qos=1, retain=retain)
+        self.pending[info.mid] = time.monotonic()
+        self.stats.add("messages")
+        self.stats.add("bytes", len(payload))
+        return info.mid
+
+    def fetch_requests(self, topics):
+        # mqtt_manager_fetch_requests: one SUBSCRIBE for every request topic,
+        # a short grace after the SUBACK for the retained messages, unsubscribe
+        _, mid = self.client.subscribe([(topic, 1) for topic in topics])
+        self.loop_until(lambda: mid in self.subacks, 1.0)
+        self.loop_until(lambda: all(topic in self.retained for topic in topics), RETAINED_GRACE)
+        self.client.unsubscribe(topics)
+        return [topic in self.retained for topic in topics]
+
+    def run(self, publish_all, changes):
+        args, trap = self.args, self.trap
+        start = time.monotonic()
+        self.connect_start = start
+        try:
+            self.client.connect(args.host, args.port, keepalive=120)
+        except OSError:
+            self.stats.add("failed")
+            return False
+
+        # mqtt_manager_init checks the connection flag every poll interval
+        poll = args.connect_poll
+        deadline = start + CONNECT_TIMEOUT
+        while not (self.connected or self.connect_failed) and time.monotonic() < deadline:
+            self.loop_until(lambda: self.connect_failed or (not poll and self.connected), poll or CONNECT_TIMEOUT)
+        if not self.connected:
+            self.stats.add("failed")
+            self.client.disconnect()
+            return False
+
+        for kind, payload in changes:
+            self.publish("%s/%s" % (trap.topic, kind), payload)
+        if args.wake_circuit and not trap.timer_wake:
+            # trigger_latency_report waits for the state PUBACK before the event
+            self.loop_until(lambda: not self.pending, TRIGGER_PUBACK_TIMEOUT)
+            self.publish(trap.topic + "/trigger", json.dumps({
+                "sensors": 1, "rtc_ms": 0, "age_ms": 15900, "latency_ms": 15800, "boot_ms": 210,
+                "count": 1, "missed": 0, "min_ms": 15800, "avg_ms": 15800, "max_ms": 15800,
+                "histogram": {"1000": 0, "2000": 0, "4000": 0, "8000": 0, "16000": 1,
+                              "32000": 0, "64000": 0, "inf": 0}}))
+        self.publish(trap.topic + "/telemetry", json.dumps({
+            "cycles": trap.cycles, "last_awake_ms": 3120, "max_awake_ms": 14870,
+            "overruns": 0, "errors": 0, "resets": 0, "last_abort": "none",
+            "last_abort_phase": "boot", "last_abort_detail": 0,
+            "heap_min_free": 142000, "heap_min_free_cycle": 151000, "heap_largest_block": 110000,
+            "stack_min_free": {"main": 1200, "mqtt_task": 2900, "tiT": 1500, "wifi": 2300}}))
+        requests = [trap.topic + "/log/request", trap.topic + "/trace/request"]
+        if publish_all:
+            requests.append(trap.topic + "/ota")
+        self.fetch_requests(requests)
+        if publish_all and args.trace_bytes:
+            # Retained; the trace buffer is only cleared after its PUBACK
+            mid = self.publish(trap.topic + "/trace", bytes(args.trace_bytes))
+            self.loop_until(lambda: mid not in self.pending, UPLOAD_ACK_TIMEOUT)
+
+        # Settle delay before cleanup, as in publish_sensor_states
+        self.loop_until(lambda: False, args.settle)
+
+        if random.random() < args.abrupt:
+            # Budget ran out: deep sleep without DISCONNECT, so the will fires
+            self.client.socket().close()
+            self.stats.add("abrupt")
+        else:
+            self.client.disconnect()
+            self.client.loop(timeout=0.01)
+        self.stats.add("session", time.monotonic() - start)
+        self.stats.add("sessions")
+        if publish_all:
+            self.stats.add("heartbeats")
+        return True
+
+
+class Fleet:
+    def __init__(self, args):
+        self.args = args
+        self.stats = Stats()
+        self.sleep_s = args.heartbeat_hours * 3600 if args.wake_circuit else args.sleep
+        self.cycles_for_publish = (3600 // args.sleep) * args.heartbeat_hours
+        self.heartbeat_s = args.heartbeat_hours * 3600
+        self.queue = []
+        self.busy = set()
+        self.busy_lock = threading.Lock()
+        for i in range(args.traps):
+            if args.align == "aligned":
+                offset = 0.0
+            elif args.align == "staggered":
+                offset = self.heartbeat_s * i / args.traps
+            else:
+                offset = random.uniform(0, self.heartbeat_s)
+            trap = Trap(i, args, offset)
+            heapq.heappush(self.queue, (trap.next_wake, i, trap))
+        # Trap state changes per simulated second (each change toggles the trap)
+        self.change_rate = args.trigger_rate / 86400.0
+
+    def apply_changes(self, trap, elapsed):
+        """Apply simulated trap and battery changes since the last wake."""
+        if self.args.wake_circuit:
+            # Every trap change wakes the device, so it is seen right away
+            if not trap.timer_wake:
+                trap.triggered = not trap.triggered
+        elif self.change_rate:
+            events = 0
+            t = random.expovariate(self.change_rate)
+            while t < elapsed:
+                events += 1
+                t += random.expovariate(self.change_rate)
+            if events % 2:
+                trap.triggered = not trap.triggered
+        if random.random() < self.args.battery_rate * elapsed / 86400.0:
+            trap.battery_low = not trap.battery_low
+
+    def wake(self, trap):
+        """Decide like publish_sensor_states; returns (publish_all, changes) or None."""
+        trap.cycles += 1
+        is_first_boot = not trap.initialized
+        trap.cycles_since_publish += 1
+        heartbeat_due = self.args.wake_circuit and trap.timer_wake
+        publish_all = is_first_boot or heartbeat_due or trap.cycles_since_publish >= self.cycles_for_publish
+        state = {"state": "triggered" if trap.triggered else "ready",
+                 "battery": "low" if trap.battery_low else "ok"}
+        changes = [(k, v) for k, v in state.items() if publish_all or trap.published[k] != v]
+        if not changes:
+            return None
+        trap.initialized = True
+        return publish_all, changes
+
+    def run_session(self, trap, publish_all, changes, due):
+        self.stats.add("lag", max(0.0, time.monotonic() - due))
+        try:
+            if Session(trap, self.args, self.stats).run(publish_all, changes):
+                for kind, payload in changes:
+                    trap.published[kind] = payload
+                trap.cycles_since_publish = 0
+        finally:
+            with self.busy_lock:
+                self.busy.discard(trap.name)
+
+    def next_wake(self, trap, now):
+        """Simulated time of the next wake, and whether it is a timer wake."""
+        timer = now + self.sleep_s * trap.drift
+        if self.args.wake_circuit and self.change_rate:
+            trigger = now + random.expovariate(self.change_rate)
+            if trigger < timer:
+                return trigger, False
+        return timer, True
+
+    def report(self, elapsed, interval):
+        sessions = interval["sessions"]
+        print("%7.1fs  sessions %4d (hb %3d, failed %d)  msgs/s %7.1f  connect p50/p99 %s/%s ms  "
+              "puback p50/p99 %s/%s ms  lag p99 %s ms" % (
+                  elapsed, sessions, interval["heartbeats"], interval["failed"],
+                  interval["messages"] / self.args.report,
+                  summarize(interval["connect"])["p50_ms"], summarize(interval["connect"])["p99_ms"],
+                  summarize(interval["puback"])["p50_ms"], summarize(interval["puback"])["p99_ms"],
+                  summarize(interval["lag"])["p99_ms"]), flush=True)
+
+    def run(self):
+        args = self.args
+        start = time.monotonic()
+        next_report = start + args.report
+        with ThreadPoolExecutor(max_workers=args.concurrency) as pool:
+            while time.monotonic() - start < args.duration:
+                now = time.monotonic()
+                if now >= next_report:
+                    self.report(now - start, self.stats.take_interval())
+                    next_report += args.report
+                if not self.queue:
+                    break
+                sim_due, index, trap = self.queue[0]
+                wall_due = start + sim_due / args.time_scale
+                if wall_due > now:
+                    time.sleep(min(wall_due - now, next_report - now, 0.05))
+                    continue
+                heapq.heappop(self.queue)
+                with self.busy_lock:
+                    busy = trap.name in self.busy
+                # A trap still in its session (only at extreme time scales) skips this wake
+                if not busy:
+                    self.apply_changes(trap, sim_due - trap.last_wake)
+                    trap.last_wake = sim_due
+                    decision = self.wake(trap)
+                    if decision:
+                        with self.busy_lock:
+                            self.busy.add(trap.name)
+                        pool.submit(self.run_session, trap, decision[0], decision[1], wall_due)
+                trap.next_wake, trap.timer_wake = self.next_wake(trap, sim_due)
+                heapq.heappush(self.queue, (trap.next_wake, index, trap))
+        return time.monotonic() - start
+
+
+class SysMonitor:
+    """Latest values of the broker's $SYS topics."""
+
+    def __init__(self, args):
+        self.values = {}
+        self.client = mqtt.Client(CallbackAPIVersion.VERSION2, client_id="fleet_sim_sys")
+        if args.username:
+            self.client.username_pw_set(args.username, args.password)
+        self.client.on_connect = lambda c, u, f, rc, p: c.subscribe("$SYS/broker/#")
+        self.client.on_message = self.on_message
+        self.client.connect(args.host, args.port)
+        self.client.loop_start()
+
+    def on_message(self, client, userdata, message):
+        self.values[message.topic[len("$SYS/broker/"):]] = message.payload.decode(errors="replace")
+
+    def stop(self):
+        self.client.loop_stop()
+        self.client.disconnect()
+        return self.values
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="localhost")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--username")
+    parser.add_argument("--password")
+    parser.add_argument("--traps", type=int, default=100, help="number of simulated traps")
+    parser.add_argument("--prefix", default="home/mousetrap", help="topic prefix")
+    parser.add_argument("--id-format", default="sim%03d", help="trap ID (TRAP_ID) format")
+    parser.add_argument("--sleep", type=int, default=1800, help="SLEEP_TIME_SECONDS")
+    parser.add_argument("--heartbeat-hours", type=int, default=24, help="HEARTBEAT_INTERVAL_HOURS")
+    parser.add_argument("--wake-circuit", action="store_true",
+                        help="USE_WAKE_CIRCUIT: wake on triggers and once per heartbeat interval")
+    parser.add_argument("--align", choices=("aligned", "staggered", "random"), default="random",
+                        help="first boot of each trap: all at once, evenly spread over the heartbeat "
+                             "interval, or random")
+    parser.add_argument("--drift", type=float, default=0.0,
+                        help="per-trap sleep timer error, +/- percent (RTC oscillator)")
+    parser.add_argument("--trigger-rate", type=float, default=0.5,
+                        help="trap state changes per trap per day")
+    parser.add_argument("--battery-rate", type=float, default=0.01,
+                        help="battery state changes per trap per day")
+    parser.add_argument("--time-scale", type=float, default=1.0,
+                        help="simulated seconds per wall-clock second for sleep and heartbeat")
+    parser.add_argument("--connect-poll", type=float, default=2.0,
+                        help="connection check interval of mqtt_manager_init, seconds")
+    parser.add_argument("--settle", type=float, default=2.0, help="settle delay before disconnect, seconds")
+    parser.add_argument("--trace-bytes", type=int, default=1024,
+                        help="burst trace uploaded on heartbeats (0 to disable)")
+    parser.add_argument("--abrupt", type=float, default=0.0,
+                        help="fraction of sessions that end without DISCONNECT (last will fires)")
+    parser.add_argument("--concurrency", type=int, default=64, help="maximum simultaneous sessions")
+    parser.add_argument("--duration", type=float, default=60.0, help="wall-clock run time, seconds")
+    parser.add_argument("--report", type=float, default=10.0, help="progress report interval, seconds")
+    parser.add_argument("--seed", type=int, help="random seed, for repeatable runs")
+    parser.add_argument("--sys", action="store_true", help="record the broker's $SYS statistics")
+    parser.add_argument("--json", help="write the summary to this file")
+    args = parser.parse_args()
+
+    if args.seed is not None:
+        random.seed(args.seed)
+    monitor = SysMonitor(args) if args.sys else None
+    fleet = Fleet(args)
+    elapsed = fleet.run()
+    total = fleet.stats.total
+
+    summary = {
+        "traps": args.traps,
+        "wall_s": round(elapsed, 1),
+        "simulated_s": round(elapsed * args.time_scale),
+        "sessions": total["sessions"],
+        "heartbeat_sessions": total["heartbeats"],
+        "failed_sessions": total["failed"],
+        "abrupt_sessions": total["abrupt"],
+        "messages": total["messages"],
+        "messages_per_s": round(total["messages"] / elapsed, 1),
+        "bytes_per_s": round(total["bytes"] / elapsed, 1),
+        "connect_latency": summarize(total["connect"]),
+        "puback_latency": summarize(total["puback"]),
+        "session_length": summarize(total["session"]),
+        "schedule_lag": summarize(total["lag"]),
+    }
+    if monitor:
+        summary["broker_sys"] = monitor.stop()
+
+    print(json.dumps(summary, indent=2))
+    if summary["schedule_lag"]["p99_ms"] > 1000:
+        print("warning: sessions started late; raise --concurrency or lower --time-scale")
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(summary, f, indent=2)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,162 @@
+#!/usr/bin/env python3
+"""Make compressed binary deltas for OTA updates.
+
+Build the running firmware and the new one, keep both .bin files, and diff
+them:
+
+    python tools/ota_delta.py make old.bin new.bin -o backdoor-1.2-1.3.ldrd
+    python tools/ota_delta.py info backdoor-1.2-1.3.ldrd
+
+The delta only applies to the exact image it was made against (its embedded
+ELF SHA-256 is checked by the device). Check it with tools/delta_apply.c
+before publishing. The format is documented in main/include/delta_patch.h.
+"""
+
+import argparse
+import hashlib
+import struct
+import sys
+import zlib
+
+MAGIC = b"LDRD"
+VERSION = 1
+FLAG_ZLIB = 0x01
+HEADER = struct.Struct("<4sBBHII32s32s")
+APP_ELF_SHA256_OFFSET = 176  # DELTA_APP_ELF_SHA256_OFFSET
+IMAGE_MAGIC = 0xE9
+
+OP_END, OP_COPY, OP_INSERT = 0, 1, 2
+
+BLOCK = 16      # Source index granularity
+MIN_COPY = 24   # Shorter matches are cheaper as literals once compressed
+
+
+def varint(value):
+    out = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+def match_length(a, a_pos, b, b_pos):
+    """Length of the common run of a[a_pos:] and b[b_pos:]."""
+    length = 0
+    limit = min(len(a) - a_pos, len(b) - b_pos)
+    # Compare in chunks first; images are mostly long identical runs
+    while length + 256 <= limit and a[a_pos + length:a_pos + length + 256] == b[b_pos + length:b_pos + length + 256]:
+        length += 256
+    while length < limit and a[a_pos + length] == b[b_pos + length]:
+        length += 1
+    return length
+
+
+def make_ops(old, new):
+    """Greedy COPY/INSERT op list rebuilding new from old."""
+    index = {}
+    for off in range(0, len(old) - BLOCK + 1, BLOCK):
+        index.setdefault(old[off:off + BLOCK], off)
+
+    ops = []
+    literal_start = 0
+    pos = 0
+    while pos + BLOCK <= len(new):
+        cand = index.get(new[pos:pos + BLOCK])
+        if cand is None:
+            pos += 1
+            continue
+        end = pos + match_length(new, pos, old, cand)
+        start, src = pos, cand
+        while start > literal_start and src > 0 and new[start - 1] == old[src - 1]:
+            start -= 1
+            src -= 1
+        if end - start < MIN_COPY:
+            pos += 1
+            continue
+        if start > literal_start:
+            ops.append((OP_INSERT, new[literal_start:start]))
+        ops.append((OP_COPY, src, end - start))
+        pos = literal_start = end
+    if literal_start < len(new):
+        ops.append((OP_INSERT, new[literal_start:]))
+    return ops
+
+
+def encode_ops(ops):
+    out = bytearray()
+    for op in ops:
+        if op[0] == OP_COPY:
+            out += bytes([OP_COPY]) + varint(op[1]) + varint(op[2])
+        else:
+            out += bytes([OP_INSERT]) + varint(len(op[1])) + op[1]
+    out.append(OP_END)
+    return bytes(out)
+
+
+def load_image(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if len(data) < APP_ELF_SHA256_OFFSET + 32 or data[0] != IMAGE_MAGIC:
+        sys.exit(f"{path}: not an ESP app image")
+    return data
+
+
+def cmd_make(args):
+    old = load_image(args.old)
+    new = load_image(args.new)
+    ops = make_ops(old, new)
+    body = encode_ops(ops)
+    flags = 0
+    if not args.no_compress:
+        body = zlib.compress(body, 9)
+        flags |= FLAG_ZLIB
+    header = HEADER.pack(MAGIC, VERSION, flags, 0, len(old), len(new),
+                         old[APP_ELF_SHA256_OFFSET:APP_ELF_SHA256_OFFSET + 32],
+                         hashlib.sha256(new).digest())
+    with open(args.output, "wb") as f:
+        f.write(header + body)
+
+    copied = sum(op[2] for op in ops if op[0] == OP_COPY)
+    print(f"{args.output}: {HEADER.size + len(body)} bytes for a {len(new)} byte image "
+          f"({100.0 * (HEADER.size + len(body)) / len(new):.1f}%), "
+          f"{len(ops)} ops, {100.0 * copied / len(new):.1f}% copied from the source")
+
+
+def cmd_info(args):
+    with open(args.delta, "rb") as f:
+        data = f.read()
+    if len(data) < HEADER.size:
+        sys.exit(f"{args.delta}: too short")
+    magic, version, flags, _, source_size, target_size, source_id, target_sha = HEADER.unpack_from(data)
+    if magic != MAGIC or version != VERSION:
+        sys.exit(f"{args.delta}: not a version {VERSION} delta")
+    print(f"source: {source_size} bytes, app ELF SHA-256 {source_id.hex()}")
+    print(f"target: {target_size} bytes, SHA-256 {target_sha.hex()}")
+    print(f"body:   {len(data) - HEADER.size} bytes{' (zlib)' if flags & FLAG_ZLIB else ''}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    make = sub.add_parser("make", help="diff two firmware images")
+    make.add_argument("old", help="image the device is running")
+    make.add_argument("new", help="image to update to")
+    make.add_argument("-o", "--output", required=True, help="delta file to write (.ldrd)")
+    make.add_argument("--no-compress", action="store_true", help="store the op stream uncompressed")
+    make.set_defaults(func=cmd_make)
+
+    info = sub.add_parser("info", help="show a delta header")
+    info.add_argument("delta")
+    info.set_defaults(func=cmd_info)
+
+    args = parser.parse_args()
+    args.func(args)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,262 @@
+#!/usr/bin/env python3
+"""Provision a trap's identity into a device running the universal image.
+
+Build and flash one image for every trap with the same hardware layout,
+then give each device its identity over serial:
+
+    python tools/provision.py /dev/ttyUSB0 --trap garage_near
+    python tools/provision.py --trap garage_near --dry-run
+
+The trap ID, sensor thresholds and state topics are read from
+traps/<trap>/config.h (or config.h.template) and written to the device's
+NVS. Every other topic moves under "home/mousetrap/<trap ID>". Extra
+settings can be given with --set key=value (keys are listed in
+main/include/device_config.h).
+
+Close any serial monitor, then run the tool and power up or reset the
+device. The tool requests diagnostic mode during the power-up countdown,
+so the button does not need to be pressed. Settings that are not
+provisioned fall back to the defaults built into the image.
+
+Requires pyserial (pip install pyserial) unless --dry-run is used.
+"""
+
+import argparse
+import os
+import re
+import sys
+import time
+
+CMD_PROVISION = b"p"
+READY = "PROVISION READY"
+TRAPS_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "traps")
+
+
+def strip_comments(text):
+    """Remove // and /* */ comments, leaving string literals alone."""
+    out = []
+    i = 0
+    while i < len(text):
+        if text[i] == '"':
+            end = i + 1
+            while end < len(text) and text[end] != '"':
+                end += 2 if text[end] == "\\" else 1
+            out.append(text[i:end + 1])
+            i = end + 1
+        elif text.startswith("//", i):
+            i = text.find("\n", i)
+            i = len(text) if i < 0 else i
+        elif text.startswith("/*", i):
+            end = text.find("*/", i + 2)
+            i = len(text) if end < 0 else end + 2
+        else:
+            out.append(text[i])
+            i += 1
+    return "".join(out)
+
+
+def read_defines(path):
+    """Map of #define names to their (unexpanded) values."""
+    with open(path) as f:
+        text = strip_comments(f.read()).replace("\\\n", " ")
+    defines = {}
+    for match in re.finditer(r"^[ \t]*#define[ \t]+(\w+)[ \t]*(.*)$", text, re.M):
+        defines[match.group(1)] = match.group(2).strip()
+    return defines
+
+
+TOKEN = re.compile(r'\s*(?:("(?:[^"\\]|\\.)*")|(\w+)|(.))')
+
+
+def evaluate(expr, defines, depth=0):
+    """Evaluate a string (adjacent literals and string macros) or an integer
+    expression, expanding macros from defines."""
+    if depth > 16:
+        raise ValueError("macro recursion in %r" % expr)
+    strings, code, is_string = [], [], False
+    for literal, name, other in TOKEN.findall(expr):
+        if literal:
+            strings.append(literal[1:-1].encode().decode("unicode_escape"))
+            is_string = True
+        elif name and name in defines:
+            value = evaluate(defines[name], defines, depth + 1)
+            if isinstance(value, str):
+                strings.append(value)
+                is_string = True
+            else:
+                code.append(str(value))
+        elif name and re.fullmatch(r"\d+[uUlL]*", name):
+            code.append(name.rstrip("uUlL"))
+        elif other and other in "()+-*/%":
+            code.append(other if other != "/" else "//")
+        elif name or other:
+            raise ValueError("cannot evaluate %r in %r" % (name or other, expr))
+    if is_string:
+        return "".join(strings)
+    return int(eval("".join(code), {"__builtins__": {}}))  # Digits and operators only
+
+
+def split_fields(entry):
+    """Split a sensor table entry on commas outside string literals."""
+    fields, current, in_string = [], [], False
+    for i, c in enumerate(entry):
+        if c == '"' and (i == 0 or entry[i - 1] != "\\"):
+            in_string = not in_string
+        if c == "," and not in_string:
+            fields.append("".join(current).strip())
+            current = []
+        else:
+            current.append(c)
+    fields.append("".join(current).strip())
+    return fields
+
+
+def trap_settings(trap):
+    """Provisioning settings for a trap, in order, from its config.h."""
+    base = os.path.join(TRAPS_DIR, trap)
+    for name in ("config.h", "config.h.template"):
+        path = os.path.join(base, name)
+        if os.path.exists(path):
+            break
+    else:
+        sys.exit("no config.h or config.h.template in %s" % base)
+
+    defines = read_defines(path)
+    if "TRAP_ID" not in defines:
+        sys.exit("%s does not define TRAP_ID" % path)
+    trap_id = evaluate(defines["TRAP_ID"], defines)
+    settings = [("id", trap_id)]
+
+    # Same default table as main/include/sensor_manager.h
+    if "SENSOR_TABLE" in defines:
+        sensors = []
+        for entry in re.findall(r"\{([^{}]*)\}", defines["SENSOR_TABLE"]):
+            fields = split_fields(entry)
+            if len(fields) != 5:
+                sys.exit("unexpected SENSOR_TABLE entry in %s: {%s}" % (path, entry))
+            sensors.append((evaluate(fields[3], defines), evaluate(fields[4], defines)))
+    else:
+        sensors = [
+            (evaluate(defines["TRAP_THRESHOLD"], defines), evaluate(defines["MQTT_TOPIC_CAUGHT"], defines)),
+            (evaluate(defines["BATTERY_THRESHOLD"], defines), evaluate(defines["MQTT_TOPIC_BATTERY"], defines)),
+        ]
+    for i, (threshold, topic) in enumerate(sensors):
+        settings.append(("thr%d" % i, str(threshold)))
+        settings.append(("topic%d" % i, topic))
+
+    if "MQTT_TOPIC_AVAILABILITY" in defines:
+        settings.append(("avail", evaluate(defines["MQTT_TOPIC_AVAILABILITY"], defines)))
+    return settings, len(sensors)
+
+
+class Device:
+    """Line protocol spoken by diagnostic mode (see main/src/diagnostic.c)."""
+
+    def __init__(self, port, baud):
+        import serial
+        self.port = serial.Serial(port, baud, timeout=0.1)
+        self.buffer = b""
+
+    def readline(self, timeout):
+        deadline = time.monotonic() + timeout
+        while b"\n" not in self.buffer:
+            if time.monotonic() > deadline:
+                return None
+            self.buffer += self.port.read(256)
+        line, self.buffer = self.buffer.split(b"\n", 1)
+        return line.decode(errors="replace").strip()
+
+    def enter(self, wait):
+        """Request diagnostic mode and provisioning; returns (sensors, trap_id)."""
+        deadline = time.monotonic() + wait
+        while time.monotonic() < deadline:
+            self.port.write(CMD_PROVISION)
+            line = self.readline(0.5)
+            while line is not None:
+                if line.startswith(READY):
+                    fields = line[len(READY):].split()
+                    # A command sent after the device flushed its input would
+                    # prefix the first line: send an empty line and drop the reply
+                    time.sleep(0.3)
+                    self.port.write(b"\n")
+                    time.sleep(0.3)
+                    self.port.reset_input_buffer()
+                    self.buffer = b""
+                    return int(fields[0]), fields[1] if len(fields) > 1 else ""
+                line = self.readline(0)
+        return None
+
+    def abort(self):
+        """Leave provisioning without writing anything (no reply)."""
+        self.port.write(b"abort\n")
+
+    def command(self, line):
+        self.port.write(line.encode() + b"\n")
+        while True:
+            reply = self.readline(5.0)
+            if reply is None:
+                return "ERR no reply"
+            if reply.startswith("OK") or reply.startswith("ERR"):
+                return reply
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port", nargs="?", help="serial port, e.g. /dev/ttyUSB0 or COM5")
+    parser.add_argument("-t", "--trap", help="trap directory under traps/ to take the identity from")
+    parser.add_argument("--set", action="append", default=[], metavar="KEY=VALUE",
+                        help="extra or overriding setting (repeatable)")
+    parser.add_argument("-b", "--baud", type=int, default=115200)
+    parser.add_argument("-w", "--wait", type=float, default=30.0,
+                        help="seconds to wait for the device to enter diagnostic mode")
+    parser.add_argument("-n", "--dry-run", action="store_true", help="print the settings and exit")
+    args = parser.parse_args()
+
+    settings, sensor_count = trap_settings(args.trap) if args.trap else ([], None)
+    for item in args.set:
+        key, sep, value = item.partition("=")
+        if not sep or not key:
+            sys.exit("--set needs KEY=VALUE, got %r" % item)
+        settings = [(k, v) for k, v in settings if k != key] + [(key, value)]
+    if not settings:
+        sys.exit("nothing to provision: give --trap and/or --set")
+
+    if args.dry_run:
+        for key, value in settings:
+            print("%s=%s" % (key, value))
+        return
+    if not args.port:
+        sys.exit("a serial port is required unless --dry-run is given")
+
+    try:
+        device = Device(args.port, args.baud)
+    except ImportError:
+        sys.exit("pyserial is required: pip install pyserial")
+
+    print("waiting for the device - power it up or reset it now")
+    entered = device.enter(args.wait)
+    if entered is None:
+        sys.exit("device did not enter provisioning - is it running the firmware and the monitor closed?")
+    device_sensors, current_id = entered
+    print("device has %d sensors, currently %r" % (device_sensors, current_id))
+    if sensor_count is not None and sensor_count != device_sensors:
+        device.abort()
+        sys.exit("trap %s defines %d sensors but the image has %d: build the image with the same sensor layout"
+                 % (args.trap, sensor_count, device_sensors))
+
+    # Start from a clean slate so settings from a previous identity do not linger
+    for line in ["erase"] + ["%s=%s" % kv for kv in settings]:
+        reply = device.command(line)
+        if not reply.startswith("OK"):
+            device.abort()
+            sys.exit("%s: %s (nothing was written)" % (line, reply))
+        print("  %s" % line)
+
+    reply = device.command("commit")
+    if not reply.startswith("OK"):
+        sys.exit("commit failed: %s" % reply)
+    print("provisioned; the device is restarting")
+
+
+if __name__ == "__main__":
+    main()
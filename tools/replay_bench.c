@@ -0,0 +1,596 @@
+// replay_bench - detection accuracy and energy regression benchmark.
+//
+// Feeds synthetic LDR scenarios (and optionally captured .ldrt traces)
+// through the firmware's burst classification (main/src/sensor_classify.c)
+// and publish decision (main/src/publish_policy.c), one wake cycle at a
+// time, as a device with the classic trap + battery sensor table in timer
+// wake mode would see them. For each scenario it reports false
+// positive/negative rates against the scenario's ground truth, samples
+// needed to decide, publishes issued and the modelled awake time and charge.
+//
+// Build (from the repository root):
+//   cc -O2 -Imain/include -o replay_bench tools/replay_bench.c
+//      main/src/sensor_classify.c main/src/publish_policy.c -lm
+//
+// Usage:
+//   ./replay_bench [-j] [-s scenario] [-n wakes] [-i interval_ms] [-b burst_ms]
+//                  [-t trap_threshold] [-B battery_threshold] [-z sleep_s]
+//                  [-H heartbeat_hours] [-r seed] [trace.ldrt@truth ...]
+//   -j      JSON output (for tools/bench_compare.py) instead of a table
+//   -s      run only the named scenario (repeatable)
+//   truth   ground truth for a captured trace: none, trap, battery or both
+//
+// Energy model options (defaults are rough M5Stamp C3 figures):
+//   -W boot_ms  -C session_ms  -M message_ms  -A burst_ma  -R radio_ma  -U sleep_ua
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "publish_policy.h"
+#include "sensor_classify.h"
+#include "trace_format.h"
+
+#define CHANNELS 2
+#define TRAP 0
+#define BATTERY 1
+#define MAX_SCENARIOS 32
+#define DAY_MS (24L * 3600 * 1000)
+#define SETTLE_MS 2000          // Settle delay before disconnecting (main.c)
+
+typedef struct {
+    int interval_ms;
+    int burst_ms;
+    int threshold[CHANNELS];
+    int sleep_s;
+    int heartbeat_hours;
+    int wakes;
+    uint32_t seed;
+    // Energy model
+    int boot_ms;
+    int session_ms;             // WiFi association, DHCP and MQTT connect
+    int message_ms;             // Per QoS 1 publish
+    double burst_ma;            // Average current while burst sampling (light sleep)
+    double radio_ma;            // Average current while connected
+    double sleep_ua;            // Deep sleep current
+} bench_config_t;
+
+typedef struct scenario scenario_t;
+
+struct scenario {
+    const char *name;
+    const char *description;
+    // Reading of a channel at time t_ms since the start of the scenario
+    int (*sample)(const scenario_t *s, int channel, long t_ms, uint32_t *rng);
+    // Ground truth (LED lit) of a channel at the start of a wake
+    bool (*truth)(const scenario_t *s, int channel, int wake, long t_ms);
+    // Captured traces
+    const char *path;
+    bool recorded_truth[CHANNELS];
+};
+
+typedef struct {
+    int tp, fp, tn, fn;
+} confusion_t;
+
+typedef struct {
+    int wakes;
+    confusion_t matrix[CHANNELS];
+    long decide_samples;        // Samples until each decision was certain
+    long detect_samples;        // Same, for positive decisions only
+    int detections;
+    int sessions;
+    int messages;
+    double awake_ms;
+    double session_ms;
+    double charge_mah;
+} result_t;
+
+static bench_config_t config = {
+    .interval_ms = 20,
+    .burst_ms = 12000,
+    .threshold = {50, 200},
+    .sleep_s = 30 * 60,
+    .heartbeat_hours = 24,
+    .wakes = 144,               // Three days at the default sleep time
+    .seed = 1,
+    .boot_ms = 60,
+    .session_ms = 3000,
+    .message_ms = 50,
+    .burst_ma = 2.5,
+    .radio_ma = 85.0,
+    .sleep_ua = 12.0,
+};
+
+// Deterministic noise so runs are comparable
+static uint32_t rng_next(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static double rng_uniform(uint32_t *state)
+{
+    return (rng_next(state) >> 8) / 16777216.0;
+}
+
+static double rng_gauss(uint32_t *state)
+{
+    double u = rng_uniform(state) + 1e-12;
+    double v = rng_uniform(state);
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+static int clamp_adc(double value)
+{
+    if (value < 0) return 0;
+    if (value > SENSOR_ADC_MAX) return SENSOR_ADC_MAX;
+    return (int)value;
+}
+
+static long wake_start_ms(int wake)
+{
+    return (long)wake * config.sleep_s * 1000;
+}
+
+// Dark enclosure: both LDRs near zero with a little ADC noise
+static double dark(uint32_t *rng)
+{
+    return 8.0 + 3.0 * rng_gauss(rng);
+}
+
+static bool blink_lit(long t_ms, int period_ms, int on_ms, int phase_ms)
+{
+    return (t_ms + phase_ms) % period_ms < on_ms;
+}
+
+static bool never(const scenario_t *s, int channel, int wake, long t_ms)
+{
+    return false;
+}
+
+static int steady_dark(const scenario_t *s, int channel, long t_ms, uint32_t *rng)
+{
+    return clamp_adc(dark(rng));
+}
+
+// Daylight leaking into the enclosure, peaking just below the trap threshold
+static int ambient_drift(const scenario_t *s, int channel, long t_ms, uint32_t *rng)
+{
+    double day = sin(2.0 * M_PI * (double)(t_ms % DAY_MS) / DAY_MS);
+    double leak = (channel == TRAP ? 38.0 : 60.0) * (day > 0 ? day : 0);
+    return clamp_adc(dark(rng) + leak);
+}
+
+// Room lamp switched on for a few hours each evening
+static int lamp_switch_on(const scenario_t *s, int channel, long t_ms, uint32_t *rng)
+{
+    long hour = (t_ms % DAY_MS) / 3600000;
+    bool lamp = hour >= 18 && hour < 22;
+    return clamp_adc(dark(rng) + (lamp ? (channel == TRAP ? 140.0 : 90.0) : 0.0));
+}
+
+// Trap triggered on day one evening and reset the next morning; the trap
+// LED blinks 60ms every second while triggered
+static bool trap_set(long t_ms)
+{
+    long triggered = 20L * 3600000 + 7 * 60000;
+    long reset = 33L * 3600000 + 11 * 60000;
+    return t_ms >= triggered && t_ms < reset;
+}
+
+static int trap_blink(const scenario_t *s, int channel, long t_ms, uint32_t *rng)
+{
+    bool lit = channel == TRAP && trap_set(t_ms) && blink_lit(t_ms, 1000, 60, 0);
+    return clamp_adc(dark(rng) + (lit ? 900.0 + 40.0 * rng_gauss(rng) : 0.0));
+}
+
+static bool trap_blink_truth(const scenario_t *s, int channel, int wake, long t_ms)
+{
+    return channel == TRAP && trap_set(t_ms);
+}
+
+// Trap battery runs low on day two: the battery LED blinks 100ms every 5s
+static int low_battery(const scenario_t *s, int channel, long t_ms, uint32_t *rng)
+{
+    bool lit = channel == BATTERY && t_ms >= 40L * 3600000 && blink_lit(t_ms, 5000, 100, 1300);
+    return clamp_adc(dark(rng) + (lit ? 700.0 + 30.0 * rng_gauss(rng) : 0.0));
+}
+
+static bool low_battery_truth(const scenario_t *s, int channel, int wake, long t_ms)
+{
+    return channel == BATTERY && t_ms >= 40L * 3600000;
+}
+
+// Noisy supply or ADC: broadband noise plus rare single-sample spikes
+static int noise(const scenario_t *s, int channel, long t_ms, uint32_t *rng)
+{
+    double value = 15.0 + 12.0 * rng_gauss(rng);
+    if (rng_next(rng) % 3000 == 0) {
+        value += 200.0 + 200.0 * rng_uniform(rng);
+    }
+    return clamp_adc(value);
+}
+
+static scenario_t scenarios[MAX_SCENARIOS] = {
+    {"steady_dark", "Dark enclosure, nothing lit", steady_dark, never},
+    {"ambient_drift", "Daylight leak peaking below the thresholds", ambient_drift, never},
+    {"lamp_switch_on", "Room lamp on 18:00-22:00 every day", lamp_switch_on, never},
+    {"trap_blink", "Trap LED blinking 60ms/1s from 20:07 to 09:11", trap_blink, trap_blink_truth},
+    {"low_battery", "Battery LED blinking 100ms/5s from day 2 16:00", low_battery, low_battery_truth},
+    {"noise", "Broadband noise with rare spikes", noise, never},
+};
+static int scenario_count = 6;
+
+static void add_decision(result_t *r, int channel, bool truth, bool active, int samples_to_decide)
+{
+    confusion_t *m = &r->matrix[channel];
+    if (truth) {
+        active ? m->tp++ : m->fn++;
+    } else {
+        active ? m->fp++ : m->tn++;
+    }
+    r->decide_samples += samples_to_decide;
+    if (active) {
+        r->detect_samples += samples_to_decide;
+        r->detections++;
+    }
+}
+
+// One wake cycle after its burst: the publish decision and the energy model
+static void finish_wake(result_t *r, const bool *state, bool *last_state, bool *initialized,
+                        unsigned *cycles_since_publish, double sleep_ms)
+{
+    const publish_context_t context = {
+        .first_boot = !*initialized,
+        .heartbeat_due = false,
+        .cycles_since_publish = ++*cycles_since_publish,
+        .cycles_for_publish = (3600 / config.sleep_s) * config.heartbeat_hours,
+    };
+    publish_decision_t decision = publish_policy_decide(&context, state, last_state, CHANNELS);
+
+    double awake_ms = config.boot_ms + config.burst_ms;
+    double charge_mas = config.burst_ma * awake_ms;
+
+    if (decision.connect) {
+        *initialized = true;
+        int messages = 0;
+        for (int i = 0; i < CHANNELS; i++) {
+            if (decision.publish_mask & (1u << i)) {
+                last_state[i] = state[i];
+                messages++;
+            }
+        }
+        // Availability and telemetry go out in every session
+        messages += 2;
+        double session_ms = config.session_ms + messages * config.message_ms + SETTLE_MS;
+        awake_ms += session_ms;
+        charge_mas += config.radio_ma * session_ms;
+        r->sessions++;
+        r->messages += messages;
+        r->session_ms += session_ms;
+        *cycles_since_publish = 0;
+    }
+
+    r->wakes++;
+    r->awake_ms += awake_ms;
+    charge_mas += config.sleep_ua / 1000.0 * sleep_ms;
+    r->charge_mah += charge_mas / 3600.0 / 1000.0;
+}
+
+static result_t run_synthetic(const scenario_t *s)
+{
+    result_t r = {0};
+    bool last_state[CHANNELS] = {false};
+    bool initialized = false;
+    unsigned cycles_since_publish = 0;
+    int samples_per_burst = config.burst_ms / config.interval_ms;
+    uint32_t rng = config.seed * 2654435761u + 1;
+
+    for (const char *c = s->name; *c; c++) {
+        rng = rng * 31 + (uint8_t)*c;
+    }
+
+    for (int wake = 0; wake < config.wakes; wake++) {
+        long start = wake_start_ms(wake);
+        sensor_data_t data[CHANNELS];
+        int decided_at[CHANNELS];
+        bool state[CHANNELS];
+
+        for (int ch = 0; ch < CHANNELS; ch++) {
+            sensor_data_reset(&data[ch]);
+            decided_at[ch] = 0;
+        }
+        for (int n = 0; n < samples_per_burst; n++) {
+            for (int ch = 0; ch < CHANNELS; ch++) {
+                sensor_data_add_sample(&data[ch], s->sample(s, ch, start + (long)n * config.interval_ms, &rng));
+                if (!decided_at[ch] && sensor_data_above_threshold(&data[ch], config.threshold[ch])) {
+                    decided_at[ch] = n + 1;
+                }
+            }
+        }
+        for (int ch = 0; ch < CHANNELS; ch++) {
+            state[ch] = sensor_data_above_threshold(&data[ch], config.threshold[ch]);
+            add_decision(&r, ch, s->truth(s, ch, wake, start), state[ch],
+                         state[ch] ? decided_at[ch] : samples_per_burst);
+        }
+        finish_wake(&r, state, last_state, &initialized, &cycles_since_publish,
+                    (double)config.sleep_s * 1000);
+    }
+    return r;
+}
+
+// Captured trace: decimated to the firmware sample rate and split into
+// bursts as in tools/trace_replay.c; each burst counts as one wake
+static int run_recorded(const scenario_t *s, result_t *r)
+{
+    FILE *f = fopen(s->path, "rb");
+    if (!f) {
+        perror(s->path);
+        return -1;
+    }
+
+    trace_file_header_t header;
+    if (fread(&header, sizeof(header), 1, f) != 1 ||
+        memcmp(header.magic, TRACE_FILE_MAGIC, 4) != 0 || header.version != TRACE_FILE_VERSION ||
+        header.sample_rate_hz == 0 || header.channels < CHANNELS) {
+        fprintf(stderr, "%s: not a version %d trace file with trap and battery channels\n",
+                s->path, TRACE_FILE_VERSION);
+        fclose(f);
+        return -1;
+    }
+
+    double step = (double)header.sample_rate_hz * config.interval_ms / 1000.0;
+    if (step < 1.0) {
+        step = 1.0;
+    }
+    int samples_per_burst = config.burst_ms / config.interval_ms;
+    uint16_t *frame = malloc(header.channels * sizeof(uint16_t));
+    bool last_state[CHANNELS] = {false};
+    bool initialized = false;
+    unsigned cycles_since_publish = 0;
+    sensor_data_t data[CHANNELS];
+    int decided_at[CHANNELS] = {0};
+    int burst_samples = 0;
+    double next_pick = 0.0;
+
+    memset(r, 0, sizeof(*r));
+    for (int ch = 0; ch < CHANNELS; ch++) {
+        sensor_data_reset(&data[ch]);
+    }
+
+    for (uint32_t i = 0; i < header.sample_count; i++) {
+        if (fread(frame, sizeof(uint16_t), header.channels, f) != header.channels) {
+            break;
+        }
+        if (i < (uint32_t)next_pick) {
+            continue;
+        }
+        next_pick += step;
+
+        for (int ch = 0; ch < CHANNELS; ch++) {
+            sensor_data_add_sample(&data[ch], frame[ch] & TRACE_SAMPLE_VALUE_MASK);
+            if (!decided_at[ch] && sensor_data_above_threshold(&data[ch], config.threshold[ch])) {
+                decided_at[ch] = burst_samples + 1;
+            }
+        }
+
+        if (++burst_samples == samples_per_burst) {
+            bool state[CHANNELS];
+            for (int ch = 0; ch < CHANNELS; ch++) {
+                state[ch] = sensor_data_above_threshold(&data[ch], config.threshold[ch]);
+                add_decision(r, ch, s->recorded_truth[ch], state[ch],
+                             state[ch] ? decided_at[ch] : samples_per_burst);
+                sensor_data_reset(&data[ch]);
+                decided_at[ch] = 0;
+            }
+            finish_wake(r, state, last_state, &initialized, &cycles_since_publish,
+                        (double)config.sleep_s * 1000);
+            burst_samples = 0;
+        }
+    }
+
+    free(frame);
+    fclose(f);
+    return 0;
+}
+
+// Rate as a JSON number, or null when there were no cases
+static void print_rate(int num, int den, bool json)
+{
+    if (den == 0) {
+        printf(json ? "null" : "%7s", "-");
+    } else {
+        printf(json ? "%.4f" : "%7.4f", (double)num / den);
+    }
+}
+
+static void print_json(const scenario_t *s, const result_t *r, bool first)
+{
+    static const char *channel_names[CHANNELS] = {"trap", "battery"};
+
+    printf("%s    {\"name\": \"%s\", \"source\": \"%s\", \"wakes\": %d", first ? "" : ",\n",
+           s->name, s->path ? s->path : "synthetic", r->wakes);
+    for (int ch = 0; ch < CHANNELS; ch++) {
+        const confusion_t *m = &r->matrix[ch];
+        printf(",\n     \"%s\": {\"tp\": %d, \"fp\": %d, \"tn\": %d, \"fn\": %d, \"fp_rate\": ",
+               channel_names[ch], m->tp, m->fp, m->tn, m->fn);
+        print_rate(m->fp, m->fp + m->tn, true);
+        printf(", \"fn_rate\": ");
+        print_rate(m->fn, m->fn + m->tp, true);
+        printf("}");
+    }
+    int decisions = r->wakes * CHANNELS;
+    printf(",\n     \"samples_to_decide_mean\": %.1f", decisions ? (double)r->decide_samples / decisions : 0.0);
+    printf(", \"samples_to_detect_mean\": ");
+    if (r->detections) {
+        printf("%.1f", (double)r->detect_samples / r->detections);
+    } else {
+        printf("null");
+    }
+    printf(",\n     \"sessions\": %d, \"messages\": %d, \"awake_ms_per_wake\": %.1f"
+           ", \"session_ms_per_wake\": %.1f, \"charge_mah_per_day\": %.4f}",
+           r->sessions, r->messages, r->wakes ? r->awake_ms / r->wakes : 0.0,
+           r->wakes ? r->session_ms / r->wakes : 0.0,
+           r->wakes ? r->charge_mah * (DAY_MS / 1000.0 / config.sleep_s) / r->wakes : 0.0);
+}
+
+static void print_row(const scenario_t *s, const result_t *r)
+{
+    int decisions = r->wakes * CHANNELS;
+    printf("%-16s %5d ", s->name, r->wakes);
+    for (int ch = 0; ch < CHANNELS; ch++) {
+        const confusion_t *m = &r->matrix[ch];
+        print_rate(m->fp, m->fp + m->tn, false);
+        printf(" ");
+        print_rate(m->fn, m->fn + m->tp, false);
+        printf(" ");
+    }
+    printf("%7.1f %8d %8d %9.0f %9.3f\n",
+           decisions ? (double)r->decide_samples / decisions : 0.0, r->sessions, r->messages,
+           r->wakes ? r->awake_ms / r->wakes : 0.0,
+           r->wakes ? r->charge_mah * (DAY_MS / 1000.0 / config.sleep_s) / r->wakes : 0.0);
+}
+
+static int add_recorded(const char *arg)
+{
+    static char paths[MAX_SCENARIOS][256];
+    const char *at = strrchr(arg, '@');
+    size_t len = at ? (size_t)(at - arg) : strlen(arg);
+    const char *truth = at ? at + 1 : "none";
+
+    if (scenario_count == MAX_SCENARIOS || len == 0 || len >= sizeof(paths[0])) {
+        fprintf(stderr, "too many traces or bad trace argument: %s\n", arg);
+        return -1;
+    }
+    scenario_t *s = &scenarios[scenario_count];
+    memcpy(paths[scenario_count], arg, len);
+    paths[scenario_count][len] = '\0';
+
+    if (strcmp(truth, "none") == 0) {
+    } else if (strcmp(truth, "trap") == 0) {
+        s->recorded_truth[TRAP] = true;
+    } else if (strcmp(truth, "battery") == 0) {
+        s->recorded_truth[BATTERY] = true;
+    } else if (strcmp(truth, "both") == 0) {
+        s->recorded_truth[TRAP] = s->recorded_truth[BATTERY] = true;
+    } else {
+        fprintf(stderr, "%s: truth must be none, trap, battery or both\n", arg);
+        return -1;
+    }
+
+    const char *base = strrchr(paths[scenario_count], '/');
+    s->name = base ? base + 1 : paths[scenario_count];
+    s->description = "Captured trace";
+    s->path = paths[scenario_count];
+    scenario_count++;
+    return 0;
+}
+
+static bool selected(const char *name, char **only, int only_count)
+{
+    if (only_count == 0) {
+        return true;
+    }
+    for (int i = 0; i < only_count; i++) {
+        if (strcmp(only[i], name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    bool json = false;
+    char *only[MAX_SCENARIOS];
+    int only_count = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "js:n:i:b:t:B:z:H:r:W:C:M:A:R:U:")) != -1) {
+        switch (opt) {
+            case 'j': json = true; break;
+            case 's':
+                if (only_count < MAX_SCENARIOS) only[only_count++] = optarg;
+                break;
+            case 'n': config.wakes = atoi(optarg); break;
+            case 'i': config.interval_ms = atoi(optarg); break;
+            case 'b': config.burst_ms = atoi(optarg); break;
+            case 't': config.threshold[TRAP] = atoi(optarg); break;
+            case 'B': config.threshold[BATTERY] = atoi(optarg); break;
+            case 'z': config.sleep_s = atoi(optarg); break;
+            case 'H': config.heartbeat_hours = atoi(optarg); break;
+            case 'r': config.seed = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'W': config.boot_ms = atoi(optarg); break;
+            case 'C': config.session_ms = atoi(optarg); break;
+            case 'M': config.message_ms = atoi(optarg); break;
+            case 'A': config.burst_ma = atof(optarg); break;
+            case 'R': config.radio_ma = atof(optarg); break;
+            case 'U': config.sleep_ua = atof(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-j] [-s scenario] [-n wakes] [-i interval_ms] [-b burst_ms] "
+                                "[-t trap_threshold] [-B battery_threshold] [-z sleep_s] [-H heartbeat_hours] "
+                                "[-r seed] [trace.ldrt@none|trap|battery|both ...]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (config.interval_ms <= 0 || config.burst_ms < config.interval_ms || config.wakes <= 0 ||
+        config.sleep_s <= 0 || config.sleep_s > 3600 || config.heartbeat_hours <= 0) {
+        fprintf(stderr, "invalid timing options\n");
+        return 2;
+    }
+    for (int i = optind; i < argc; i++) {
+        if (add_recorded(argv[i]) != 0) {
+            return 2;
+        }
+    }
+
+    if (json) {
+        printf("{\n  \"config\": {\"interval_ms\": %d, \"burst_ms\": %d, \"trap_threshold\": %d, "
+               "\"battery_threshold\": %d, \"sleep_s\": %d, \"heartbeat_hours\": %d, \"wakes\": %d, "
+               "\"seed\": %u},\n  \"scenarios\": [\n",
+               config.interval_ms, config.burst_ms, config.threshold[TRAP], config.threshold[BATTERY],
+               config.sleep_s, config.heartbeat_hours, config.wakes, config.seed);
+    } else {
+        printf("%-16s %5s %7s %7s %7s %7s %7s %8s %8s %9s %9s\n", "scenario", "wakes",
+               "trap_fp", "trap_fn", "batt_fp", "batt_fn", "decide", "sessions", "messages",
+               "awake_ms", "mAh/day");
+    }
+
+    int ran = 0;
+    for (int i = 0; i < scenario_count; i++) {
+        const scenario_t *s = &scenarios[i];
+        if (!selected(s->name, only, only_count)) {
+            continue;
+        }
+        result_t r;
+        if (s->path) {
+            if (run_recorded(s, &r) != 0) {
+                return 1;
+            }
+        } else {
+            r = run_synthetic(s);
+        }
+        if (json) {
+            print_json(s, &r, ran == 0);
+        } else {
+            print_row(s, &r);
+        }
+        ran++;
+    }
+
+    if (json) {
+        printf("\n  ]\n}\n");
+    }
+    if (ran == 0) {
+        fprintf(stderr, "no scenario selected\n");
+        return 2;
+    }
+    return 0;
+}
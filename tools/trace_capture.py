@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+"""Capture a high-rate sensor trace from a device in diagnostic mode.
+
+Put the device in diagnostic mode (hold the button during power-up), close
+any serial monitor, then run:
+
+    python tools/trace_capture.py /dev/ttyUSB0 -o blink.ldrt --seconds 30
+
+The tool sends the start command, validates each framed packet (sync bytes,
+CRC-16 and sequence number) and writes the samples to a .ldrt trace file
+that tools/trace_replay.c can feed through the firmware's classification
+code. Packet formats are defined in main/include/trace_format.h.
+
+Requires pyserial (pip install pyserial).
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+try:
+    import serial
+except ImportError:
+    sys.exit("pyserial is required: pip install pyserial")
+
+SYNC = b"\xa5\x5a"
+PACKET_HEADER = struct.Struct("<2sBBBBHIH")
+FILE_HEADER = struct.Struct("<4sHBBII")
+PACKET_SAMPLES = 1
+FLAG_DROPPED = 0x01
+TRACE_FLAG_GAPS = 0x01
+CMD_START = b"s"
+CMD_STOP = b"q"
+
+
+def crc16(data, crc=0xFFFF):
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+class PacketReader:
+    """Extract valid packets from a raw byte stream."""
+
+    def __init__(self):
+        self.buffer = bytearray()
+        self.crc_errors = 0
+
+    def feed(self, data):
+        self.buffer += data
+        packets = []
+        while True:
+            start = self.buffer.find(SYNC)
+            if start < 0:
+                del self.buffer[:-1]
+                break
+            del self.buffer[:start]
+            if len(self.buffer) < PACKET_HEADER.size:
+                break
+            _, ptype, channels, count, flags, seq, t0_us, period_us = PACKET_HEADER.unpack_from(self.buffer)
+            total = PACKET_HEADER.size + count * channels * 2 + 2
+            if len(self.buffer) < total:
+                break
+            (crc,) = struct.unpack_from("<H", self.buffer, total - 2)
+            if ptype != PACKET_SAMPLES or crc16(self.buffer[2:total - 2]) != crc:
+                # Not a real packet (or corrupted): resync past these sync bytes
+                self.crc_errors += 1
+                del self.buffer[:2]
+                continue
+            samples = struct.unpack_from("<%dH" % (count * channels), self.buffer, PACKET_HEADER.size)
+            packets.append((channels, count, flags, seq, t0_us, period_us, samples))
+            del self.buffer[:total]
+        return packets
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port", help="serial port, e.g. /dev/ttyUSB0 or COM5")
+    parser.add_argument("-o", "--output", required=True, help="trace file to write (.ldrt)")
+    parser.add_argument("-b", "--baud", type=int, default=115200)
+    parser.add_argument("-s", "--seconds", type=float, default=10.0, help="capture duration")
+    args = parser.parse_args()
+
+    port = serial.Serial(args.port, args.baud, timeout=0.1)
+    port.reset_input_buffer()
+    port.write(CMD_START)
+
+    reader = PacketReader()
+    samples = []
+    channels = None
+    period_us = None
+    expected_seq = None
+    gaps = 0
+    deadline = time.monotonic() + args.seconds
+
+    try:
+        while time.monotonic() < deadline:
+            for packet in reader.feed(port.read(4096)):
+                pch, count, flags, seq, t0_us, pperiod, values = packet
+                if channels is None:
+                    channels, period_us = pch, pperiod
+                if expected_seq is not None and seq != expected_seq:
+                    gaps += (seq - expected_seq) & 0xFFFF
+                if flags & FLAG_DROPPED:
+                    gaps += 1
+                expected_seq = (seq + 1) & 0xFFFF
+                samples.extend(values)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        port.write(CMD_STOP)
+        port.close()
+
+    if channels is None:
+        sys.exit("no packets received - is the device in diagnostic mode?")
+
+    sample_count = len(samples) // channels
+    rate_hz = round(1_000_000 / period_us)
+    with open(args.output, "wb") as f:
+        f.write(FILE_HEADER.pack(b"LDRT", 1, channels, TRACE_FLAG_GAPS if gaps else 0, rate_hz, sample_count))
+        f.write(struct.pack("<%dH" % len(samples), *samples))
+
+    print("captured %d samples x %d channels at %d Hz (%.1f s) to %s"
+          % (sample_count, channels, rate_hz, sample_count / rate_hz, args.output))
+    if gaps or reader.crc_errors:
+        print("warning: %d lost packets/sample blocks, %d CRC errors" % (gaps, reader.crc_errors))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+"""Decode compressed burst traces uploaded by the firmware.
+
+Fetch the latest upload and decode it:
+
+    mosquitto_sub -h broker -t home/mousetrap/backdoor/trace -C 1 > trace.bin
+    python tools/trace_decode.py trace.bin
+
+Prints one CSV row per trace sample. With --ldrt PREFIX each burst is also
+written as PREFIX_<seq>.ldrt so it can be replayed with tools/trace_replay.c.
+The upload does not say which sensors are wake pins, so name their channels
+with --wake-channels to set the wake pin bit that trace_replay -w reads.
+The record format is documented in main/include/trace_codec.h.
+"""
+
+import argparse
+import struct
+import sys
+
+BLOB_MAGIC = 0x5A52444C
+BLOB_HEADER = struct.Struct("<IBBH")
+RECORD_HEADER = struct.Struct("<HHBBHH")
+FILE_HEADER = struct.Struct("<4sHBBII")
+MAX_CHANNELS = 8  # TRACE_CODEC_MAX_CHANNELS; bit n of the mask is sensor table entry n
+SAMPLE_WAKE_PIN = 0x8000  # TRACE_SAMPLE_WAKE_PIN
+
+
+def read_varint(data, pos):
+    value, shift = 0, 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, pos
+
+
+def decode_records(data):
+    magic, version, records, length = BLOB_HEADER.unpack_from(data)
+    if magic != BLOB_MAGIC or version != 1:
+        sys.exit("not a version 1 trace blob")
+    pos = BLOB_HEADER.size
+    end = pos + length
+    for _ in range(records):
+        rec_len, seq, mask, decimation, interval_ms, count = RECORD_HEADER.unpack_from(data, pos)
+        channels = [i for i in range(MAX_CHANNELS) if mask & (1 << i)]
+        p = pos + RECORD_HEADER.size
+        prev = [0] * len(channels)
+        samples = []
+        for _ in range(count):
+            row = []
+            for ch in range(len(channels)):
+                zz, p = read_varint(data, p)
+                prev[ch] += (zz >> 1) ^ -(zz & 1)
+                row.append(prev[ch])
+            samples.append(row)
+        yield seq, channels, decimation, interval_ms, samples
+        pos += rec_len
+        if pos > end:
+            sys.exit("trace blob truncated")
+
+
+def write_ldrt(path, channels, period_ms, samples, wake_channels=()):
+    # .ldrt channel n is sensor table entry n (at least two channels, as
+    # trace_replay expects); channels missing from the record are written as 0.
+    # A wake pin sensor reads 0 or the ADC maximum, so its level bit is set on
+    # every non-zero sample
+    width = max(2, max(channels, default=0) + 1)
+    values = []
+    for row in samples:
+        full = [0] * width
+        for ch, value in zip(channels, row):
+            full[ch] = value | SAMPLE_WAKE_PIN if ch in wake_channels and value else value
+        values.extend(full)
+    rate_hz = max(1, round(1000 / period_ms))
+    with open(path, "wb") as f:
+        f.write(FILE_HEADER.pack(b"LDRT", 1, width, 0, rate_hz, len(samples)))
+        f.write(struct.pack("<%dH" % len(values), *values))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", help="uploaded trace blob")
+    parser.add_argument("--ldrt", metavar="PREFIX", help="also write each burst as PREFIX_<seq>.ldrt")
+    parser.add_argument("--wake-channels", metavar="N[,N...]", default="",
+                        help="sensor table entries that are wake pins (sets the wake pin bit in .ldrt files)")
+    args = parser.parse_args()
+    try:
+        wake_channels = {int(ch) for ch in args.wake_channels.split(",") if ch.strip()}
+    except ValueError:
+        parser.error("--wake-channels takes comma-separated channel numbers")
+
+    data = open(args.input, "rb").read()
+    print("burst,t_ms,channel,value")
+    for seq, channels, decimation, interval_ms, samples in decode_records(data):
+        period_ms = interval_ms * decimation
+        for i, row in enumerate(samples):
+            for ch, value in zip(channels, row):
+                print("%d,%d,sensor%d,%d" % (seq, i * period_ms, ch, value))
+        if args.ldrt:
+            write_ldrt("%s_%d.ldrt" % (args.ldrt, seq), channels, period_ms, samples, wake_channels)
+
+
+if __name__ == "__main__":
+    main()
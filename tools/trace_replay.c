@@ -0,0 +1,144 @@
+// trace_replay - feed a captured .ldrt trace through the firmware's burst
+// classification (main/src/sensor_classify.c).
+//
+// The trace is decimated to the firmware's SAMPLE_INTERVAL_MS and split into
+// bursts of BURST_DURATION_MS, exactly as sensor_manager_burst_sample would
+// see it, and each burst is classified against the given thresholds.
+//
+// Build (from the repository root):
+//   cc -O2 -Imain/include -o trace_replay tools/trace_replay.c main/src/sensor_classify.c
+//
+// Usage:
+//   ./trace_replay [-i interval_ms] [-b burst_ms] [-t trap_threshold]
+//                  [-B battery_threshold] [-c trap_channel] [-C battery_channel]
+//                  [-w] trace.ldrt
+//   -c/-C  trace channels (sensor table entries) to classify as trap and
+//          battery (default 0 and 1)
+//   -w     classify the trap from the wake pin bit of its channel instead
+//          of the reading
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sensor_classify.h"
+#include "trace_format.h"
+
+int main(int argc, char **argv)
+{
+    int interval_ms = 20;
+    int burst_ms = 12000;
+    int trap_threshold = 50;
+    int battery_threshold = 200;
+    int trap_channel = 0;
+    int battery_channel = 1;
+    int use_wake_pin = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:b:t:B:c:C:w")) != -1) {
+        switch (opt) {
+            case 'i': interval_ms = atoi(optarg); break;
+            case 'b': burst_ms = atoi(optarg); break;
+            case 't': trap_threshold = atoi(optarg); break;
+            case 'B': battery_threshold = atoi(optarg); break;
+            case 'c': trap_channel = atoi(optarg); break;
+            case 'C': battery_channel = atoi(optarg); break;
+            case 'w': use_wake_pin = 1; break;
+            default:
+                fprintf(stderr, "usage: %s [-i interval_ms] [-b burst_ms] [-t trap_threshold] "
+                                "[-B battery_threshold] [-c trap_channel] [-C battery_channel] [-w] trace.ldrt\n",
+                        argv[0]);
+                return 2;
+        }
+    }
+    if (optind >= argc || interval_ms <= 0 || burst_ms < interval_ms) {
+        fprintf(stderr, "usage: %s [options] trace.ldrt\n", argv[0]);
+        return 2;
+    }
+
+    FILE *f = fopen(argv[optind], "rb");
+    if (!f) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    trace_file_header_t header;
+    if (fread(&header, sizeof(header), 1, f) != 1 ||
+        memcmp(header.magic, TRACE_FILE_MAGIC, 4) != 0 || header.version != TRACE_FILE_VERSION ||
+        header.sample_rate_hz == 0 || trap_channel < 0 || battery_channel < 0 ||
+        trap_channel >= header.channels || battery_channel >= header.channels) {
+        fprintf(stderr, "%s: not a version %d trace file with channels %d and %d\n",
+                argv[optind], TRACE_FILE_VERSION, trap_channel, battery_channel);
+        fclose(f);
+        return 1;
+    }
+
+    // Trace samples per firmware sample, and firmware samples per burst
+    double step = (double)header.sample_rate_hz * interval_ms / 1000.0;
+    int samples_per_burst = burst_ms / interval_ms;
+    if (step < 1.0) {
+        fprintf(stderr, "warning: trace rate %u Hz is below the firmware sample rate\n",
+                header.sample_rate_hz);
+        step = 1.0;
+    }
+
+    printf("# %s: %u samples at %u Hz, %s%s\n", argv[optind], header.sample_count,
+           header.sample_rate_hz, use_wake_pin ? "trap from wake pin" : "trap from its channel",
+           (header.flags & TRACE_FLAG_GAPS) ? ", capture has gaps" : "");
+    printf("burst,start_ms,samples,trap_min,trap_max,battery_min,battery_max,trap,battery\n");
+
+    uint16_t *frame = malloc(header.channels * sizeof(uint16_t));
+    sensor_data_t trap, battery;
+    int burst = 0, burst_samples = 0, triggered_bursts = 0, low_bursts = 0;
+    double next_pick = 0.0;
+    long burst_start = 0;
+
+    sensor_data_reset(&trap);
+    sensor_data_reset(&battery);
+
+    for (uint32_t i = 0; i < header.sample_count; i++) {
+        if (fread(frame, sizeof(uint16_t), header.channels, f) != header.channels) {
+            fprintf(stderr, "warning: trace truncated at sample %u\n", i);
+            break;
+        }
+        if (i < (uint32_t)next_pick) {
+            continue;
+        }
+        next_pick += step;
+
+        if (burst_samples == 0) {
+            burst_start = (long)i * 1000 / header.sample_rate_hz;
+        }
+
+        int trap_value = use_wake_pin
+            ? ((frame[trap_channel] & TRACE_SAMPLE_WAKE_PIN) ? SENSOR_ADC_MAX : 0)
+            : (frame[trap_channel] & TRACE_SAMPLE_VALUE_MASK);
+        sensor_data_add_sample(&trap, trap_value);
+        sensor_data_add_sample(&battery, frame[battery_channel] & TRACE_SAMPLE_VALUE_MASK);
+
+        if (++burst_samples == samples_per_burst) {
+            bool trap_triggered = sensor_data_above_threshold(&trap, trap_threshold);
+            bool battery_low = sensor_data_above_threshold(&battery, battery_threshold);
+            printf("%d,%ld,%d,%d,%d,%d,%d,%s,%s\n", burst, burst_start, burst_samples,
+                   trap.min_value, trap.max_value, battery.min_value, battery.max_value,
+                   trap_triggered ? "triggered" : "ready", battery_low ? "low" : "ok");
+            triggered_bursts += trap_triggered;
+            low_bursts += battery_low;
+            burst++;
+            burst_samples = 0;
+            sensor_data_reset(&trap);
+            sensor_data_reset(&battery);
+        }
+    }
+
+    printf("# %d full bursts: %d triggered, %d battery low", burst, triggered_bursts, low_bursts);
+    if (burst_samples > 0) {
+        printf(" (%d trailing samples ignored)", burst_samples);
+    }
+    printf("\n");
+
+    free(frame);
+    fclose(f);
+    return 0;
+}